@@ -19,58 +19,120 @@
  *
  */
 
+#include <cstring>
 #include <QDebug>
-#include <QTime>
+#include <QElapsedTimer>
+#include <QBitArray>
 #include <QFile>
-#include <QSerialPort>
+#include <QVector>
+#include <QJsonArray>
+#include <QPair>
+#include "imagecache.h"
+#include "devicestore.h"
+#include "wiretrace.h"
+#include "lz4block.h"
+#include "imagewriter.h"
+#include "chipdatabase.h"
+#include "transport.h"
+#include "qtcompat.h"
 #include "bootloader.h"
 
-const char Ack = 0x79;
-const char Nack = 0x1f;
 const char GetCommand = 0x00;
 const char GetVersionCommand = 0x01;
 const char GetIDCommand = 0x02;
 const char ReadMemoryCommand = 0x11;
+const char GoCommand = 0x21;
 const char WriteMemoryCommand = 0x31;
 const char EraseMemoryCommand = 0x43;
 const char ExtendedEraseMemoryCommand = 0x44;
 const qint32 FlashBaseAddress = 0x08000000;
-
-QMap<int, int> Bootloader::densityMap;
+const int BlockSize = 256;
+const int LegacyErasePagesPerFrame = 255;
+const int ExtendedErasePagesPerFrame = 256;
+const int EraseBaseMsecs = 500;
+const int EraseMsecsPerSector = 20;
+const int EraseMsecsPerKB = 30;
+const int MassEraseMsecs = 30000;
+const quint16 ExtendedMassErase = 0xffff;
+const quint16 ExtendedBank1Erase = 0xfffe;
+const int ErasableBanks = 2;
+const int UniqueIdSize = 12;
+const int SampleBlocks = 8;
+const int StubRetries = 5;
+const int StubPingMsecs = 100;
+const int StubFlashMsecs = 500;
+const int BitsPerByte = 11;
+const int DefaultAckMsecs = 50;
+const int MinAckMsecs = 20;
+const int RttFactor = 2;
+const int CommandBytes = 3;
+const int WriteProgramMsecs = 20;
+const int FrameRetries = 3;
+const int ResyncBytes = 300;
+const int JournalReserveBytes = 16 * 1024;
+const int ResumeCheckBytes = 2048;
 
 Bootloader::Bootloader(QObject *parent) :
     QThread(parent),
-    serialPort(0)
+    differential(false),
+    verify(false),
+    massErase(false),
+    skipFlashed(false),
+    runApplication(false),
+    resume(false),
+    readoutAddress(FlashBaseAddress),
+    readoutSize(0),
+    readoutBytes(0),
+    readoutNsecs(0),
+    stubBaudrate(0),
+    stubAddress(0),
+    stubWindow(1),
+    stubBlockSize(BlockSize),
+    trace(0),
+    transport(0),
+    rttNsecs(0),
+    rttSample(0),
+    journaling(false),
+    resumed(false),
+    sentEnd(0),
+    success(false),
+    started(false),
+    stubRunning(false),
+    elapsed(0),
+    currentPhase(OpenPhase),
+    phaseStart(0)
 {
-    if (densityMap.empty()) {
-        densityMap[0x412] = 1024;
-        densityMap[0x410] = 1024;
-        densityMap[0x414] = 2048;
-        densityMap[0x418] = 2048;
-        densityMap[0x420] = 1024;
-        densityMap[0x428] = 2048;
-        densityMap[0x430] = 2048;
-        densityMap[0x436] = 256;
-        densityMap[0x416] = 256;
-    }
+    buffer.reserve(256);
+    for (int i = 0; i < PhaseCount; i++)
+        phaseTimes[i] = 0;
 }
 
 Bootloader::~Bootloader()
 {
+    delete trace;
+}
 
+void Bootloader::setOptions(const Bootloader *other)
+{
+    baudrate = other->baudrate;
+    baudrates = other->baudrates;
+    filename = other->filename;
+    differential = other->differential;
+    verify = other->verify;
+    massErase = other->massErase;
+    skipFlashed = other->skipFlashed;
+    runApplication = other->runApplication;
+    resume = other->resume;
+    stubFilename = other->stubFilename;
+    stubBaudrate = other->stubBaudrate;
+    stubAddress = other->stubAddress;
 }
 
 bool Bootloader::openSerial()
 {
-    serialPort = new QSerialPort();
-    serialPort->setPortName(portName);
-    serialPort->setBaudRate(baudrate);
-    serialPort->setDataBits(QSerialPort::Data8);
-    serialPort->setFlowControl(QSerialPort::NoFlowControl);
-    serialPort->setParity(QSerialPort::EvenParity);
-    serialPort->setStopBits(QSerialPort::OneStop);
-    if (!serialPort->open(QIODevice::ReadWrite)) {
-        qDebug() << "serialPort open:" << serialPort->error();
+    transport = Transport::create(portName);
+    if (!transport->open(baudrate)) {
+        qDebug() << "Open" << portName << "failed:" << transport->errorString();
         return false;
     }
 
@@ -84,32 +146,30 @@ void Bootloader::closeSerial()
 
 void Bootloader::bootModeEnter()
 {
-    serialPort->flush();
-    serialPort->setDataTerminalReady(true);
-    serialPort->setRequestToSend(true);
+    transport->setDataTerminalReady(true);
+    transport->setRequestToSend(true);
     msleep(100);
-    serialPort->readAll();
-    serialPort->setRequestToSend(false);
+    transport->discardInput();
+    parser.clear();
+    transport->setRequestToSend(false);
     msleep(10);
 }
 
 void Bootloader::bootModeExit()
 {
-    if (serialPort) {
-        if (serialPort->isOpen()) {
+    if (transport) {
 #if 0
-            serialPort->flush();
-            serialPort->setDataTerminalReady(false);
-            serialPort->setRequestToSend(true);
-            msleep(100);
-            serialPort->readAll();
-            serialPort->setRequestToSend(false);
-            msleep(10);
+        transport->setDataTerminalReady(false);
+        transport->setRequestToSend(true);
+        msleep(100);
+        transport->discardInput();
+        transport->setRequestToSend(false);
+        msleep(10);
 #endif
-            serialPort->close();
-        }
-        delete serialPort;
-        serialPort = 0;
+        transport->close();
+        delete transport;
+        transport = 0;
+        emit portReleased();
     }
 
     exit(-1);
@@ -125,32 +185,154 @@ void Bootloader::bootModeExit()
 
 void Bootloader::run()
 {
-    bool ret;
+    QElapsedTimer timer;
+    timer.start();
+    success = false;
+    started = false;
+    stubRunning = false;
+    chip = ChipInfo();
+    journal = FlashJournal();
+    journalUid.clear();
+    journaling = false;
+    resumed = false;
+    sentEnd = 0;
+    readoutBytes = 0;
+    readoutNsecs = 0;
+    for (int i = 0; i < PhaseCount; i++)
+        phaseTimes[i] = 0;
+    currentPhase = OpenPhase;
+    phaseStart = 0;
+    phaseTimer.start();
+    if (traceFile.isEmpty()) {
+        delete trace;
+        trace = 0;
+    } else {
+        if (!trace)
+            trace = new WireTrace();
+        trace->start();
+        trace->mark(phaseName(OpenPhase));
+    }
+    session();
+    preparer.wait();
+    if (journaling && !success) {
+        if (sentEnd)
+            journal.reserved = qMax(sentEnd, journal.confirmed);
+        DeviceStore::instance()->saveJournal(portName, journalUid, journal);
+    }
+    enterPhase(currentPhase);
+    elapsed = timer.elapsed();
+    if (trace) {
+        QString error;
+        if (!trace->save(traceFile, &error))
+            qDebug() << "Save wire trace:" << error;
+    }
+    emit completed(success, elapsed);
+    emit reported(report());
+}
 
-    if (!openSerial()) {
-        return;
+void Bootloader::enterPhase(Phase phase)
+{
+    qint64 now = phaseTimer.nsecsElapsed();
+    phaseTimes[currentPhase] += now - phaseStart;
+    phaseStart = now;
+    currentPhase = phase;
+    if (trace)
+        trace->mark(phaseName(phase));
+}
+
+const char *Bootloader::phaseName(Phase phase)
+{
+    static const char *const names[PhaseCount] = {
+        "open", "boot", "sync", "identify", "load", "compare", "erase", "stub", "write", "verify", "read", "exit"
+    };
+    return names[phase];
+}
+
+QJsonObject Bootloader::report() const
+{
+    QJsonObject phases;
+    for (int i = 0; i < PhaseCount; i++)
+        phases.insert(phaseName(Phase(i)), phaseTimes[i] / 1000000.0);
+
+    int buckets = SessionStats::HistogramBuckets;
+    while (buckets > 0 && stats.histogram[buckets - 1] == 0)
+        buckets--;
+    QJsonArray histogram;
+    for (int i = 0; i < buckets; i++)
+        histogram.append(stats.histogram[i]);
+
+    QJsonObject ack;
+    ack.insert("transactions", stats.transactions);
+    ack.insert("nacks", stats.nacks);
+    ack.insert("timeouts", stats.timeouts);
+    ack.insert("wait_ms", stats.totalNsecs / 1000000.0);
+    ack.insert("max_wait_ms", stats.maxNsecs / 1000000.0);
+    ack.insert("histogram_log2_us", histogram);
+    ack.insert("rtt_ms", rttNsecs / 1000000.0);
+
+    QJsonObject report;
+    report.insert("port", portName);
+    report.insert("image", filename);
+    report.insert("baudrate", baudrate);
+    report.insert("success", success);
+    report.insert("started", started);
+    report.insert("resumed", resumed);
+    report.insert("phase", QString(phaseName(currentPhase)));
+    report.insert("elapsed_ms", double(elapsed));
+    report.insert("phases_ms", phases);
+    report.insert("bytes_sent", double(stats.bytesSent));
+    report.insert("bytes_received", double(stats.bytesReceived));
+    report.insert("retries", stats.retries);
+    report.insert("ack", ack);
+    if (chip.isValid()) {
+        report.insert("chip_id", chip.chipId);
+        report.insert("chip", chip.name);
     }
+    if (!readoutFilename.isEmpty()) {
+        QJsonObject read;
+        read.insert("file", readoutFilename);
+        read.insert("address", double(readoutAddress));
+        read.insert("bytes", double(readoutBytes));
+        read.insert("ms", readoutNsecs / 1000000.0);
+        read.insert("bytes_per_sec", readoutNsecs > 0 ? readoutBytes * 1e9 / readoutNsecs : 0.0);
+        report.insert("readout", read);
+    }
+    return report;
+}
 
-    bootModeEnter();
+void Bootloader::session()
+{
+    bool ret;
 
-    if (!autoBaudrateSeq()) {
+    stats = SessionStats();
+    if (readoutFilename.isEmpty())
+        preparer.prepare(filename, image);
+    rttNsecs = 0;
+    rttSample = 0;
+
+    if (!openSerial()) {
         bootModeExit();
         return;
     }
 
-    writeCmd(GetVersionCommand);
-    checkWaitForAck("Get version command");
-    checkWaitForAck("Get version command");
-    qDebug() << "Get version command" << buffer.toHex();
-    if (!ret) {
+    if (!negotiateBaudrate()) {
         bootModeExit();
         return;
     }
 
     emit progressValue(0);
 
+    enterPhase(IdentifyPhase);
+    if (!getCommands()) {
+        bootModeExit();
+        return;
+    }
+
+    QElapsedTimer rtt;
+    rtt.start();
     writeCmd(GetIDCommand);
     checkWaitForAck("Get ID command");
+    sampleRtt(rtt);
     checkWaitForAck("Get ID command");
     qDebug() << "Get ID command" << buffer.toHex();
     if (!ret) {
@@ -158,72 +340,505 @@ void Bootloader::run()
         return;
     }
 
+    rttNsecs = rttSample;
+    qDebug() << "Round trip:" << rttNsecs / 1000 << "us, command timeout:" << ackMsecs(CommandBytes) << "ms";
+
     emit progressValue(5);
 
-    int chipId = buffer.at(1) << 8 | buffer.at(2);
-    int density;
-    if (densityMap.contains(chipId)) {
-        density = densityMap.value(chipId);
-    } else {
-        qDebug() << "Cannot find density by chip id:" << chipId;
+    int chipId = uchar(buffer.at(1)) << 8 | uchar(buffer.at(2));
+    if (!ChipDatabase::instance()->contains(chipId)) {
+        qDebug() << "Unknown chip id:" << Qt::hex << chipId << ", add it to chips.ini";
         bootModeExit();
         return;
     }
-    qDebug() << "Chip ID:" << chipId << ", Density:" << density;
+    chip = ChipDatabase::instance()->chip(chipId);
+    qDebug() << "Chip ID:" << Qt::hex << chipId << chip.name << ", flash:" << Qt::dec << chip.flashSize() / 1024
+             << "KB in" << chip.sectors.size() << "sectors";
 
-    emit progressValue(10);
+    QByteArray uid;
+    if ((skipFlashed || resume) && chip.uniqueIdAddress) {
+        if (readMemory(chip.uniqueIdAddress, UniqueIdSize, uid)) {
+            qDebug() << "Unique ID:" << uid.toHex();
+        } else {
+            qDebug() << "Cannot read unique ID, device cache and journal disabled";
+            uid.clear();
+        }
+    }
 
-    QFile file(filename);
-    ret = file.open(QIODevice::ReadOnly);
-    const QByteArray &bin = file.readAll();
-    file.close();
+    emit progressValue(10);
 
-    int binSize = bin.size();
-    int binPos = 0;
-    qDebug() << "bin size:" << binSize << ret;
+    if (!readoutFilename.isEmpty()) {
+        enterPhase(ReadPhase);
+        if (!readout()) {
+            bootModeExit();
+            return;
+        }
+        leaveBootloader();
+        success = true;
+        return;
+    }
 
-    if (!ret)
+    enterPhase(LoadPhase);
+    preparer.wait();
+    ImageHandle cached = preparer.image();
+    if (!cached) {
+        qDebug() << "Cannot load" << filename << ":" << preparer.errorString();
+        bootModeExit();
         return;
+    }
+    qDebug() << "Image prepared in" << preparer.elapsedNsecs() / 1000 << "us," << preparer.blocks().size() << "blocks";
+
+    const FirmwareImage &firmware = cached->image();
+    const QList<FirmwareImage::Segment> &segments = firmware.segments();
+    QBitArray dirty(chip.sectors.size());
+    foreach (const FirmwareImage::Segment &segment, segments) {
+        QList<int> sectors = chip.sectorsFor(segment.address, segment.end());
+        if (sectors.isEmpty()) {
+            qDebug() << "Image segment at" << Qt::hex << segment.address << "lies outside flash";
+            bootModeExit();
+            return;
+        }
+        dirty.fill(true, sectors.first(), sectors.last() + 1);
+    }
+
+    qDebug() << "image size:" << firmware.size() << "in" << segments.size() << "segments";
 
     emit progressValue(15);
 
-    writeCmd(EraseMemoryCommand);
-    checkWaitForAck("Erase memory command");
-#if 0
-    writeCmd(0xff);
-    qDebug() << "Erase all of pages";
-#else
-    int numOfPages = (binSize + density - 1) / density;
-    QByteArray pages;
-    for (int i = 0; i < numOfPages; i++) {
-        pages.append(i);
-    }
-    writeData(pages);
-    qDebug() << "Erase num of pages:" << numOfPages;
-#endif
-    checkWaitForAckMsecs("Erase memory command", 2000);
+    if (skipFlashed && !uid.isEmpty() && DeviceStore::instance()->imageHash(uid) == cached->hash()) {
+        enterPhase(ComparePhase);
+        if (sampleMatches(cached)) {
+            qDebug() << "Device already programmed on" << DeviceStore::instance()->timestamp(uid).toString() << ", skipped";
+            leaveBootloader();
+            emit progressValue(100);
+            success = true;
+            return;
+        }
+        qDebug() << "Sampled blocks differ from recorded image";
+    }
+
+    if (skipFlashed && !uid.isEmpty())
+        DeviceStore::instance()->remove(uid);
+
+    bool resuming = false;
+    if (resume && !uid.isEmpty()) {
+        journalUid = uid;
+        resuming = DeviceStore::instance()->journal(portName, uid, journal) && journal.hash == cached->hash();
+        foreach (int sector, journal.sectors)
+            resuming = resuming && sector >= 0 && sector < chip.sectors.size();
+        if (!resuming) {
+            journal = FlashJournal();
+            journal.hash = cached->hash();
+        }
+    }
+
+    if (resuming) {
+        dirty.fill(false);
+        foreach (int sector, journal.sectors)
+            dirty.setBit(sector);
+        qDebug() << "Resume interrupted session, confirmed up to" << Qt::hex << journal.confirmed;
+    } else if (differential && !massErase) {
+        enterPhase(ComparePhase);
+        int covered = dirty.count(true);
+        if (!comparePages(firmware, dirty)) {
+            qDebug() << "Read back flash pages failed";
+            bootModeExit();
+            return;
+        }
+        qDebug() << "Changed sectors:" << dirty.count(true) << "of" << covered;
+    }
+
+    QList<int> pages;
+    for (int i = 0; i < dirty.size(); i++) {
+        if (dirty.testBit(i))
+            pages.append(i);
+    }
+    if (!journalUid.isEmpty() && !resuming) {
+        journal.sectors = pages;
+        journal.confirmed = pages.isEmpty() ? 0 : chip.sectors.at(pages.first()).address;
+        journal.reserved = journal.confirmed;
+        DeviceStore::instance()->saveJournal(portName, journalUid, journal);
+    }
+    journaling = !journalUid.isEmpty();
+
+    QList<int> erase = pages;
+    foreach (int sector, journal.erased)
+        erase.removeOne(sector);
+
+    enterPhase(ErasePhase);
+    if (massErase && journal.erased.isEmpty()) {
+        if (!eraseMass()) {
+            bootModeExit();
+            return;
+        }
+    } else if (!massErase && !erase.isEmpty()) {
+        if (!eraseBanks(erase) || (!erase.isEmpty() && !erasePages(erase))) {
+            bootModeExit();
+            return;
+        }
+    }
+
+    if (journaling && journal.erased != pages) {
+        journal.erased = pages;
+        DeviceStore::instance()->saveJournal(portName, journalUid, journal);
+    }
+
+    quint32 resumeFrom = 0;
+    if (resuming) {
+        if (!resumePoint(cached, dirty, resumeFrom)) {
+            bootModeExit();
+            return;
+        }
+        resumed = true;
+    }
 
     emit progressValue(20);
 
-    do {
-        int bytes = binSize - binPos;
-        bytes = bytes > 256 ? 256 : bytes;
-        bytes = ((bytes + 3) / 4) * 4;
-        QByteArray buf(256, 0xff);
-        buf.replace(0, bytes, bin.mid(binPos, bytes));
-        writeCmd(WriteMemoryCommand);
-        checkWaitForAck("Write memory command");
-        writeAddr(FlashBaseAddress + binPos);
-        checkWaitForAck("Write memory command");
-        writeData(buf);
-        checkWaitForAckMsecs("Write memory command", 2000);
-        binPos += bytes;
-        emit progressValue(80 * binPos / binSize + 20);
-    } while (binPos < binSize);
+    int writeSize = 0;
+    int blankCount = 0;
+    int blockCount = 0;
+    for (int s = 0; s < segments.size(); s++) {
+        const FirmwareImage::Segment &segment = segments.at(s);
+        const QBitArray &blank = cached->blankBlocks(s);
+        for (int i = 0; i < blank.size(); i++) {
+            quint32 addr = segment.address + i * BlockSize;
+            if (!blank.testBit(i) && dirty.testBit(chip.sectorAt(addr)))
+                writeSize += qMin(BlockSize, segment.data.size() - i * BlockSize);
+        }
+        blankCount += blank.count(true);
+        blockCount += blank.size();
+    }
+    int written = 0;
+    int total = verify ? writeSize * 2 : writeSize;
+    qDebug() << "Skip blank blocks:" << blankCount << "of" << blockCount;
 
-    bootModeExit();
+    for (int s = 0; resumeFrom && s < segments.size(); s++) {
+        const FirmwareImage::Segment &segment = segments.at(s);
+        const QBitArray &blank = cached->blankBlocks(s);
+        for (int i = 0; i < blank.size(); i++) {
+            quint32 addr = segment.address + i * BlockSize;
+            int bytes = qMin(BlockSize, segment.data.size() - i * BlockSize);
+            if (!blank.testBit(i) && dirty.testBit(chip.sectorAt(addr)) && addr + bytes <= resumeFrom)
+                written += bytes;
+        }
+    }
+
+    if (!stubFilename.isEmpty()) {
+        enterPhase(StubPhase);
+        if (!startStub()) {
+            bootModeExit();
+            return;
+        }
+
+        QList<StubBlock> blocks;
+        for (int s = 0; s < segments.size(); s++) {
+            const QByteArray &bin = segments.at(s).data;
+            const QBitArray &blank = cached->blankBlocks(s);
+            quint32 base = segments.at(s).address;
+            for (int binPos = 0; binPos < bin.size(); binPos += BlockSize) {
+                if (blank.testBit(binPos / BlockSize) || !dirty.testBit(chip.sectorAt(base + binPos)))
+                    continue;
+                int bytes = qMin(BlockSize, bin.size() - binPos);
+                quint32 addr = base + binPos;
+                if (addr + bytes <= resumeFrom)
+                    continue;
+                if (!blocks.isEmpty() && blocks.last().address + blocks.last().data.size() == addr
+                        && blocks.last().data.size() + bytes <= stubBlockSize) {
+                    blocks.last().data.append(bin.constData() + binPos, bytes);
+                } else {
+                    StubBlock block;
+                    block.address = addr;
+                    block.data = QByteArray(bin.constData() + binPos, bytes);
+                    blocks.append(block);
+                }
+            }
+        }
+        for (int i = 0; i < blocks.size(); i++) {
+            while (blocks.at(i).data.size() % 4)
+                blocks[i].data.append(char(0xff));
+        }
+
+        enterPhase(WritePhase);
+        if (!stubWrite(blocks, written, total)) {
+            bootModeExit();
+            return;
+        }
 
+        if (verify) {
+            enterPhase(VerifyPhase);
+            if (!stubVerify(blocks, written, total)) {
+                dropJournal();
+                bootModeExit();
+                return;
+            }
+            qDebug() << "Verify passed";
+        }
+    } else {
+        enterPhase(WritePhase);
+        foreach (const ImagePreparer::Block &block, preparer.blocks()) {
+            if (!dirty.testBit(chip.sectorAt(block.address)) || block.address + block.size <= resumeFrom)
+                continue;
+            written += block.size;
+            reserve(block.address + BlockSize);
+            const int frameSize = qMin(chip.maxWrite, BlockSize);
+            for (int pos = 0; pos < block.size; pos += frameSize) {
+                payload.clear();
+                payload.data(block.data + pos, qMin(frameSize, block.size - pos), frameSize);
+                if (!writeFrame(block.address + pos, payload.constData(), payload.size())) {
+                    qDebug() << "Write memory failed at" << Qt::hex << block.address + pos << ", buffer:" << buffer.toHex();
+                    bootModeExit();
+                    return;
+                }
+            }
+            confirm(block.address + block.size);
+            emit progressValue(80 * written / total + 20);
+        }
+
+        if (verify) {
+            enterPhase(VerifyPhase);
+            QByteArray flash;
+            flash.reserve(BlockSize);
+            for (int s = 0; s < segments.size(); s++) {
+                const QByteArray &bin = segments.at(s).data;
+                const QBitArray &blank = cached->blankBlocks(s);
+                quint32 base = segments.at(s).address;
+                int binSize = bin.size();
+                for (int binPos = 0; binPos < binSize; binPos += BlockSize) {
+                    if (blank.testBit(binPos / BlockSize) || !dirty.testBit(chip.sectorAt(base + binPos)))
+                        continue;
+                    if (!readMemory(base + binPos, BlockSize, flash)) {
+                        qDebug() << "Verify read failed at" << Qt::hex << base + binPos;
+                        bootModeExit();
+                        return;
+                    }
+                    int offset = firstMismatch(bin, binPos, flash);
+                    if (offset >= 0) {
+                        qDebug() << "Verify failed at" << Qt::hex << base + binPos + offset;
+                        dropJournal();
+                        bootModeExit();
+                        return;
+                    }
+                    written += qMin(BlockSize, binSize - binPos);
+                    emit progressValue(80 * written / total + 20);
+                }
+            }
+            qDebug() << "Verify passed";
+        }
+    }
+
+    dropJournal();
+    if (skipFlashed && !uid.isEmpty())
+        DeviceStore::instance()->record(uid, cached->hash());
+
+    leaveBootloader();
+
+    success = true;
     qDebug() << "programe finished";
+    qDebug() << "Ack transactions:" << stats.transactions
+             << ", total wait:" << stats.totalNsecs / 1000000 << "ms"
+             << ", max wait:" << stats.maxNsecs / 1000 << "us";
+}
+
+/*
+ * Read every sector the image covers and clear its dirty bit when the flash
+ * already holds the same bytes. Blocks of a sector outside the image are
+ * expected to be erased, as a full erase would have left them.
+ */
+bool Bootloader::comparePages(const FirmwareImage &firmware, QBitArray &dirty)
+{
+    const QList<FirmwareImage::Segment> &segments = firmware.segments();
+    QByteArray flash;
+    flash.reserve(BlockSize);
+    int covered = dirty.count(true);
+    int compared = 0;
+
+    for (int page = 0; page < dirty.size(); page++) {
+        if (!dirty.testBit(page))
+            continue;
+
+        bool same = true;
+        const ChipInfo::Sector &sector = chip.sectors.at(page);
+        for (quint32 addr = sector.address; same && addr < sector.address + sector.size; addr += BlockSize) {
+            if (!readMemory(addr, BlockSize, flash))
+                return false;
+            int index = firmware.segmentAt(addr);
+            if (index < 0)
+                same = firstMismatch(QByteArray(), 0, flash) < 0;
+            else
+                same = firstMismatch(segments.at(index).data, addr - segments.at(index).address, flash) < 0;
+        }
+        dirty.setBit(page, !same);
+        emit progressValue(15 + 5 * ++compared / covered);
+    }
+
+    return true;
+}
+
+/*
+ * Cheap confirmation that a device still holds a recorded image: read a
+ * handful of non-blank blocks spread evenly over the image and check
+ * them against the checksums precomputed by the image cache.
+ */
+bool Bootloader::sampleMatches(const ImageHandle &cached)
+{
+    const QList<FirmwareImage::Segment> &segments = cached->image().segments();
+    QList<QPair<int, int> > blocks;
+
+    for (int s = 0; s < segments.size(); s++) {
+        const QBitArray &blank = cached->blankBlocks(s);
+        for (int i = 0; i < blank.size(); i++) {
+            if (!blank.testBit(i))
+                blocks.append(qMakePair(s, i));
+        }
+    }
+
+    int samples = qMin(SampleBlocks, blocks.size());
+    QByteArray flash;
+    flash.reserve(BlockSize);
+
+    for (int n = 0; n < samples; n++) {
+        const QPair<int, int> &block = blocks.at(samples > 1 ? n * (blocks.size() - 1) / (samples - 1) : 0);
+        const QByteArray &data = segments.at(block.first).data;
+        int offset = block.second * BlockSize;
+        int bytes = qMin(BlockSize, data.size() - offset);
+        if (!readMemory(segments.at(block.first).address + offset, bytes, flash))
+            return false;
+        if (FirmwareImage::crc32(flash.constData(), bytes) != cached->blockChecksum(block.first, block.second))
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Journal of the write in progress. Before a frame ending past the reserved
+ * address is sent, the reservation is moved on and saved, so a session that
+ * dies without a chance to save still leaves a bound on what may have been
+ * programmed beyond the last confirmed write.
+ */
+void Bootloader::reserve(quint32 end)
+{
+    sentEnd = qMax(sentEnd, end);
+    if (!journaling || end <= journal.reserved)
+        return;
+    journal.reserved = end + JournalReserveBytes;
+    DeviceStore::instance()->saveJournal(portName, journalUid, journal);
+}
+
+void Bootloader::confirm(quint32 end)
+{
+    if (journaling)
+        journal.confirmed = qMax(journal.confirmed, end);
+}
+
+void Bootloader::dropJournal()
+{
+    if (!journaling)
+        return;
+    journaling = false;
+    DeviceStore::instance()->removeJournal(portName, journalUid);
+}
+
+/*
+ * Address of the first block still to be written at or above from.
+ */
+bool Bootloader::nextWrite(const ImageHandle &cached, const QBitArray &dirty, quint32 from, quint32 &addr)
+{
+    const QList<FirmwareImage::Segment> &segments = cached->image().segments();
+    for (int s = 0; s < segments.size(); s++) {
+        const QBitArray &blank = cached->blankBlocks(s);
+        for (int i = 0; i < blank.size(); i++) {
+            addr = segments.at(s).address + i * BlockSize;
+            if (addr >= from && !blank.testBit(i) && dirty.testBit(chip.sectorAt(addr)))
+                return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Pick up an interrupted session. The flash below the next block to write,
+ * back to the start of its sector and at most ResumeCheckBytes, must hold
+ * the image, and that block must still be blank. Otherwise the sectors from
+ * there up to the journal's reservation may hold a partial write: they are
+ * erased again and rewritten from the start of the boundary sector.
+ */
+bool Bootloader::resumePoint(const ImageHandle &cached, const QBitArray &dirty, quint32 &from)
+{
+    const FirmwareImage &firmware = cached->image();
+    const QList<FirmwareImage::Segment> &segments = firmware.segments();
+    quint32 next;
+    if (!nextWrite(cached, dirty, journal.confirmed, next)) {
+        from = journal.confirmed;
+        qDebug() << "Interrupted session had written everything";
+        return true;
+    }
+
+    int sector = chip.sectorAt(next);
+    quint32 start = chip.sectors.at(sector).address;
+    quint32 check = next - start > quint32(ResumeCheckBytes) ? next - ResumeCheckBytes : start;
+    QByteArray flash;
+    flash.reserve(BlockSize);
+    bool intact = true;
+
+    for (quint32 addr = check; intact && addr < next; addr += BlockSize) {
+        int bytes = int(qMin(quint32(BlockSize), next - addr));
+        if (!readMemory(addr, bytes, flash))
+            return false;
+        int index = firmware.segmentAt(addr);
+        if (index < 0)
+            intact = firstMismatch(QByteArray(), 0, flash) < 0;
+        else
+            intact = firstMismatch(segments.at(index).data, addr - segments.at(index).address, flash) < 0;
+    }
+    if (intact) {
+        if (!readMemory(next, BlockSize, flash))
+            return false;
+        intact = firstMismatch(QByteArray(), 0, flash) < 0;
+    }
+
+    if (intact) {
+        from = next;
+        qDebug() << "Boundary intact, continue at" << Qt::hex << from;
+        return true;
+    }
+
+    quint32 end = qMax(journal.reserved, next + BlockSize);
+    QList<int> sectors;
+    for (int i = sector; i < chip.sectors.size() && chip.sectors.at(i).address < end; i++) {
+        if (dirty.testBit(i))
+            sectors.append(i);
+    }
+    qDebug() << "Boundary at" << Qt::hex << next << "not as left, erase" << Qt::dec << sectors.size() << "sectors again";
+    enterPhase(ErasePhase);
+    if (!erasePages(sectors))
+        return false;
+    from = start;
+    journal.confirmed = start;
+    journal.reserved = end;
+    DeviceStore::instance()->saveJournal(portName, journalUid, journal);
+    return true;
+}
+
+int Bootloader::firstMismatch(const QByteArray &bin, int pos, const QByteArray &flash)
+{
+    int size = flash.size();
+    int bytes = qBound(0, bin.size() - pos, size);
+    const char *image = bin.constData() + pos;
+
+    if (memcmp(flash.constData(), image, bytes) != 0) {
+        for (int i = 0; i < bytes; i++) {
+            if (flash.at(i) != image[i])
+                return i;
+        }
+    }
+
+    for (int i = bytes; i < size; i++) {
+        if (uchar(flash.at(i)) != 0xff)
+            return i;
+    }
+
+    return -1;
 }
 
 char Bootloader::checkSum(const QByteArray &data)
@@ -245,97 +860,850 @@ char Bootloader::checkSum(const QByteArray &data)
 
 qint64 Bootloader::write(char ch)
 {
-    return serialPort->write(QByteArray(1, ch));
+    return send(&ch, 1);
 }
 
 qint64 Bootloader::writeCmd(char cmd)
 {
-    QByteArray array;
-    array.append(cmd);
-    array.append(~cmd);
-    return serialPort->write(array);
+    control.clear();
+    control.command(quint8(cmd));
+    return send(control);
 }
 
 qint64 Bootloader::writeAddr(quint32 addr)
 {
-    QByteArray array;
-    array.append((addr >> 24) & 0xff);
-    array.append((addr >> 16) & 0xff);
-    array.append((addr >>  8) & 0xff);
-    array.append((addr >>  0) & 0xff);
-    array.append(checkSum(array));
-    return serialPort->write(array);
+    control.clear();
+    control.address(addr);
+    return send(control);
+}
+
+/*
+ * Each frame waits for its ACK before the next goes out: the ROM receives
+ * unbuffered while it transmits, and after a NACKed address it would take
+ * the byte count frame for a new command.
+ */
+bool Bootloader::readMemoryFrame(quint32 addr, int size, QByteArray &data)
+{
+    writeCmd(ReadMemoryCommand);
+    if (!waitForAck())
+        return false;
+    writeAddr(addr);
+    if (!waitForAck(ackMsecs(5 + 1)))
+        return false;
+    writeCmd(char(size - 1));
+    if (!waitForAck())
+        return false;
+
+    return waitForBytes(size, data);
+}
+
+bool Bootloader::readMemory(quint32 addr, int size, QByteArray &data)
+{
+    for (int attempt = 0; !readMemoryFrame(addr, size, data); attempt++) {
+        if (attempt == FrameRetries || !resync())
+            return false;
+        stats.retries++;
+        qDebug() << "Retry Read Memory at" << Qt::hex << addr;
+    }
+    return true;
 }
 
-qint64 Bootloader::writeBytesRead(char size)
+
+bool Bootloader::waitForRead(int msec)
 {
-    return writeCmd(size - 1);
+    return transport->waitForReadyRead(msec);
 }
 
-qint64 Bootloader::writeData(const QByteArray &data)
+qint64 Bootloader::send(const char *data, qint64 size)
 {
-    int size = data.size();
-    QByteArray array;
+    qint64 sent = transport->write(data, size);
+    if (sent > 0) {
+        stats.bytesSent += sent;
+        if (trace)
+            trace->record(WireTrace::Tx, data, int(sent));
+    }
+    return sent;
+}
 
-    array.append(size - 1);
-    array.append(data);
-    array.append(checkSum(array));
+qint64 Bootloader::send(const QByteArray &data)
+{
+    return send(data.constData(), data.size());
+}
 
-    return serialPort->write(array);
+qint64 Bootloader::send(const FrameEncoder &frame)
+{
+    return send(frame.constData(), frame.size());
 }
 
-bool Bootloader::waitForRead(int msec)
+bool Bootloader::readResponse(qint64 msec)
 {
-    return serialPort->waitForReadyRead(msec);
+    char chunk[1024];
+
+    if (!transport->bytesAvailable()) {
+        if (msec <= 0 || !waitForRead(int(msec)))
+            return false;
+    }
+
+    qint64 size = transport->read(chunk, sizeof(chunk));
+    if (size <= 0)
+        return false;
+
+    parser.append(chunk, size);
+    stats.bytesReceived += size;
+    if (trace)
+        trace->record(WireTrace::Rx, chunk, int(size));
+    return true;
 }
 
 bool Bootloader::waitForAck(int msec)
 {
-    QTime timeout = QTime::currentTime().addMSecs(msec);
-    buffer.clear();
-    bool ack = false;
+    QElapsedTimer timer;
+    timer.start();
+    ResponseParser::Frame frame;
+    if (msec <= 0)
+        msec = ackMsecs(CommandBytes);
 
     forever {
-        if (serialPort->bytesAvailable()) {
-            QByteArray array = serialPort->read(1);
-            char ch = array.at(0);
-            if (ch == Ack) {
-                ack = true;
-                break;
-            } else if (ch == Nack) {
-                qDebug() << "Wait for Ack, Nack received";
-                break;
-            } else {
-                buffer.append(ch);
+        frame = parser.takeFrame(buffer);
+        if (frame != ResponseParser::NoFrame)
+            break;
+        if (!readResponse(msec - timer.elapsed()))
+            break;
+    }
+
+    qint64 nsecs = timer.nsecsElapsed();
+    stats.transactions++;
+    stats.totalNsecs += nsecs;
+    if (nsecs > stats.maxNsecs)
+        stats.maxNsecs = nsecs;
+    int bucket = 0;
+    for (qint64 usecs = nsecs / 1000; usecs > 1 && bucket < SessionStats::HistogramBuckets - 1; usecs >>= 1)
+        bucket++;
+    stats.histogram[bucket]++;
+
+    if (frame == ResponseParser::NackFrame) {
+        stats.nacks++;
+        qDebug() << "Wait for Ack, Nack received";
+    } else if (frame == ResponseParser::NoFrame) {
+        stats.timeouts++;
+        if (trace)
+            trace->mark("timeout");
+        buffer = parser.pending();
+        qDebug() << "Wait for Ack timeout";
+    }
+
+    return frame == ResponseParser::AckFrame;
+}
+
+bool Bootloader::waitForBytes(int size, QByteArray &data, int msec)
+{
+    QElapsedTimer timer;
+    timer.start();
+    if (msec <= 0)
+        msec = ackMsecs(size);
+
+    while (!parser.takeBytes(size, data)) {
+        if (!readResponse(msec - timer.elapsed())) {
+            qDebug() << "Wait for" << size << "bytes timeout, received" << parser.bytesAvailable();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Reply timeout for a frame of the given size: a multiple of the round trip
+ * seen during identification plus the time the frame and its reply spend on
+ * the wire. Until identification has been timed the fixed 50 ms applies.
+ */
+int Bootloader::ackMsecs(int bytes) const
+{
+    if (!rttNsecs)
+        return DefaultAckMsecs;
+    qint64 nsecs = RttFactor * rttNsecs + qint64(bytes) * BitsPerByte * 1000000000 / qMax(baudrate, 1200);
+    return qMax(MinAckMsecs, int(nsecs / 1000000) + 1);
+}
+
+void Bootloader::sampleRtt(const QElapsedTimer &timer)
+{
+    rttSample = qMax(rttSample, timer.nsecsElapsed());
+}
+
+/*
+ * Bring the bootloader back to waiting for a command after a lost or
+ * garbled frame. Single 0xff bytes are fed until it answers: a reply means
+ * whatever it was collecting is complete, and 0xff can neither start a valid
+ * command nor finish a mass erase. Command 0xff must then come back as a
+ * lone NACK.
+ */
+bool Bootloader::resync()
+{
+    if (trace)
+        trace->mark("resync");
+
+    int quiet = ackMsecs(1);
+    parser.clear();
+    while (readResponse(quiet))
+        parser.clear();
+
+    bool answered = false;
+    for (int i = 0; i < ResyncBytes && !answered; i++) {
+        write(char(0xff));
+        answered = readResponse(quiet);
+    }
+    while (readResponse(quiet))
+        ;
+    parser.clear();
+    if (!answered) {
+        qDebug() << "Resync failed, bootloader silent";
+        return false;
+    }
+
+    writeCmd(char(0xff));
+    readResponse(ackMsecs(CommandBytes));
+    while (readResponse(quiet))
+        ;
+    bool synced = parser.takeFrame(buffer) == ResponseParser::NackFrame && buffer.isEmpty()
+            && parser.bytesAvailable() == 0;
+    parser.clear();
+    if (!synced)
+        qDebug() << "Resync failed, buffer:" << buffer.toHex();
+    return synced;
+}
+
+bool Bootloader::getCommands()
+{
+    QElapsedTimer rtt;
+    rtt.start();
+    writeCmd(GetCommand);
+    if (!waitForAck()) {
+        qDebug() << "Get command failed, buffer:" << buffer.toHex();
+        return false;
+    }
+    sampleRtt(rtt);
+    if (!waitForAck() || buffer.size() < 2) {
+        qDebug() << "Get command failed, buffer:" << buffer.toHex();
+        return false;
+    }
+
+    commands = buffer.mid(2);
+    qDebug() << "Bootloader version:" << Qt::hex << uchar(buffer.at(1)) << ", commands:" << commands.toHex();
+    return true;
+}
+
+/*
+ * Pages are erased in as few frames as the bootloader accepts: 16-bit
+ * page numbers through Extended Erase when it is listed by Get, else the
+ * legacy one-byte form, which cannot reach past page 255. Each frame is
+ * given EraseBaseMsecs plus eraseMsecs() for every sector it lists; whole
+ * banks are taken off the list beforehand by eraseBanks().
+ */
+bool Bootloader::erasePages(const QList<int> &pages)
+{
+    bool extended = commands.contains(ExtendedEraseMemoryCommand);
+    int perFrame = extended ? ExtendedErasePagesPerFrame : LegacyErasePagesPerFrame;
+
+    if (!extended && pages.last() > 0xff) {
+        qDebug() << "Page" << pages.last() << "needs Extended Erase, which the bootloader does not support";
+        return false;
+    }
+
+    for (int from = 0; from < pages.size(); from += perFrame) {
+        int count = qMin(perFrame, pages.size() - from);
+        int msecs = EraseBaseMsecs;
+        QByteArray frame;
+
+        if (extended) {
+            frame.append(((count - 1) >> 8) & 0xff);
+            frame.append((count - 1) & 0xff);
+            for (int i = from; i < from + count; i++) {
+                msecs += eraseMsecs(pages.at(i));
+                frame.append((pages.at(i) >> 8) & 0xff);
+                frame.append(pages.at(i) & 0xff);
             }
+            frame.append(checkSum(frame));
         } else {
-            if (QTime::currentTime() > timeout) {
-                qDebug() << "Wait for Ack timeout";
-                break;
-            } else {
-                waitForRead(1);
+            frame.append(count - 1);
+            for (int i = from; i < from + count; i++) {
+                msecs += eraseMsecs(pages.at(i));
+                frame.append(pages.at(i));
             }
+            frame.append(checkSum(frame));
+        }
+
+        writeCmd(extended ? ExtendedEraseMemoryCommand : EraseMemoryCommand);
+        if (!waitForAck()) {
+            qDebug() << "Erase memory command failed, buffer:" << buffer.toHex();
+            return false;
+        }
+        send(frame);
+        if (!waitForAck(msecs + ackMsecs(frame.size() + 1))) {
+            qDebug() << "Erase of" << count << "sectors from" << pages.at(from) << "failed, buffer:" << buffer.toHex();
+            return false;
+        }
+    }
+
+    qDebug() << "Erase num of sectors:" << pages.size();
+    return true;
+}
+
+/*
+ * 20 ms per sector plus 30 ms per KB of it.
+ */
+int Bootloader::eraseMsecs(int sector) const
+{
+    return EraseMsecsPerSector + chip.sectors.at(sector).size / 1024 * EraseMsecsPerKB;
+}
+
+/*
+ * A bank whose sectors all need erasing goes in one Extended Erase bank
+ * command (0xfffe, 0xfffd) instead of a sector list; its sectors are
+ * taken off pages.
+ */
+bool Bootloader::eraseBanks(QList<int> &pages)
+{
+    if (chip.banks.size() < 2 || !commands.contains(ExtendedEraseMemoryCommand))
+        return true;
+
+    for (int bank = 0; bank < qMin(chip.banks.size(), ErasableBanks); bank++) {
+        int first = chip.banks.at(bank);
+        int end = bank + 1 < chip.banks.size() ? chip.banks.at(bank + 1) : chip.sectors.size();
+        int msecs = EraseBaseMsecs;
+        bool whole = first < end;
+        for (int i = first; whole && i < end; i++) {
+            whole = pages.contains(i);
+            msecs += eraseMsecs(i);
+        }
+        if (!whole)
+            continue;
+
+        if (!eraseSpecial(quint16(ExtendedBank1Erase - bank), msecs))
+            return false;
+        for (int i = first; i < end; i++)
+            pages.removeOne(i);
+    }
+
+    return true;
+}
+
+bool Bootloader::eraseMass()
+{
+    return eraseSpecial(ExtendedMassErase, MassEraseMsecs);
+}
+
+bool Bootloader::eraseSpecial(quint16 code, int msecs)
+{
+    bool extended = commands.contains(ExtendedEraseMemoryCommand);
+
+    writeCmd(extended ? ExtendedEraseMemoryCommand : EraseMemoryCommand);
+    if (!waitForAck()) {
+        qDebug() << "Erase memory command failed, buffer:" << buffer.toHex();
+        return false;
+    }
+
+    if (extended) {
+        QByteArray frame;
+        frame.append((code >> 8) & 0xff);
+        frame.append(code & 0xff);
+        frame.append(checkSum(frame));
+        send(frame);
+    } else if (code == ExtendedMassErase) {
+        writeCmd(0xff);
+    } else {
+        qDebug() << "Bank erase needs Extended Erase";
+        return false;
+    }
+
+    if (!waitForAck(msecs)) {
+        qDebug() << "Special erase" << Qt::hex << code << "failed, buffer:" << buffer.toHex();
+        return false;
+    }
+
+    qDebug() << "Special erase" << Qt::hex << code << "done";
+    return true;
+}
+
+bool Bootloader::getVersion()
+{
+    QElapsedTimer rtt;
+    rtt.start();
+    writeCmd(GetVersionCommand);
+    if (!waitForAck()) {
+        qDebug() << "Get version command failed, buffer:" << buffer.toHex();
+        return false;
+    }
+    sampleRtt(rtt);
+    if (!waitForAck()) {
+        qDebug() << "Get version command failed, buffer:" << buffer.toHex();
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * The bootloader locks onto the rate of the first 0x7f it sees after
+ * reset, so every step down the ladder re-enters boot mode before the
+ * sync and is only accepted once Get Version is answered at that rate.
+ */
+bool Bootloader::negotiateBaudrate()
+{
+    QList<qint32> ladder = baudrates;
+    if (ladder.isEmpty())
+        ladder << baudrate;
+
+    for (int i = 0; i < ladder.size(); i++) {
+        qint32 rate = ladder.at(i);
+        if (!transport->setBaudRate(rate)) {
+            qDebug() << "Baudrate" << rate << "not supported by adapter";
+            continue;
         }
+
+        enterPhase(BootEntryPhase);
+        bootModeEnter();
+
+        enterPhase(SyncPhase);
+        if (autoBaudrateSeq() && getVersion()) {
+            qDebug() << "Bootloader connected at" << rate;
+            baudrate = rate;
+            if (!baudrates.isEmpty())
+                emit baudrateNegotiated(rate);
+            return true;
+        }
+
+        qDebug() << "Baudrate" << rate << "failed";
+        stats.retries++;
     }
 
-    return ack;
+    return false;
 }
 
 bool Bootloader::autoBaudrateSeq()
 {
-    bool ack = false;
     write(0x7f);
 
-    if (waitForRead(5)) {
-        QByteArray data = serialPort->readAll();
-        if (data.at(0) == Ack) {
-            ack = true;
-        } else {
-            qDebug() << "Auto-Baud rate sequence failed:" << data.toHex();
+    if (!waitForAck(5)) {
+        qDebug() << "Auto-Baud rate sequence failed:" << buffer.toHex();
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Read Memory frames go out back to back, one per 256 bytes, and each block
+ * is handed straight to the writer so only one block is held in memory.
+ * The size defaults to the flash size register of the part.
+ */
+bool Bootloader::readout()
+{
+    quint32 size = readoutSize;
+    if (size == 0 && readoutAddress == chip.flashAddress()) {
+        QByteArray kb;
+        if (chip.flashSizeRegister && readMemory(chip.flashSizeRegister, 2, kb))
+            chip.truncate((uchar(kb.at(0)) | uchar(kb.at(1)) << 8) * 1024);
+        size = chip.flashSize();
+    }
+    if (size == 0) {
+        qDebug() << "Readout size unknown for" << chip.name << ", give it explicitly";
+        return false;
+    }
+
+    ImageWriter writer;
+    if (!writer.open(readoutFilename)) {
+        qDebug() << "Cannot create" << readoutFilename << ":" << writer.errorString();
+        return false;
+    }
+
+    qDebug() << "Read" << size << "bytes from" << Qt::hex << readoutAddress;
+    QElapsedTimer timer;
+    timer.start();
+    QByteArray block;
+    block.reserve(BlockSize);
+    int percent = -1;
+
+    for (quint32 offset = 0; offset < size; offset += BlockSize) {
+        int bytes = int(qMin(quint32(BlockSize), size - offset));
+        if (!readMemory(readoutAddress + offset, bytes, block)) {
+            qDebug() << "Read memory failed at" << Qt::hex << readoutAddress + offset;
+            writer.close();
+            return false;
+        }
+        if (!writer.write(readoutAddress + offset, block)) {
+            qDebug() << "Write" << readoutFilename << "failed:" << writer.errorString();
+            writer.close();
+            return false;
+        }
+
+        readoutBytes += bytes;
+        readoutNsecs = timer.nsecsElapsed();
+        if (int(90 * readoutBytes / size) != percent) {
+            percent = int(90 * readoutBytes / size);
+            emit progressValue(percent + 10);
+        }
+    }
+
+    if (!writer.close()) {
+        qDebug() << "Write" << readoutFilename << "failed:" << writer.errorString();
+        return false;
+    }
+
+    qDebug() << "Read" << readoutBytes << "bytes in" << readoutNsecs / 1000000 << "ms,"
+             << readoutBytes * 1000000000 / qMax(readoutNsecs, qint64(1)) << "bytes/s";
+    return true;
+}
+
+bool Bootloader::writeMemoryFrame(quint32 addr, const char *frame, int size)
+{
+    writeCmd(WriteMemoryCommand);
+    if (!waitForAck())
+        return false;
+    writeAddr(addr);
+    if (!waitForAck(ackMsecs(5 + 1)))
+        return false;
+    send(frame, size);
+    return waitForAck(ackMsecs(size + 1) + WriteProgramMsecs);
+}
+
+/*
+ * A NACK or a lost reply costs one resync and a resend of this frame
+ * instead of the whole session. Only the ACK may have been lost, and
+ * F0/F1/F3/L1 refuse to program a half-word that is not erased, so the
+ * block is read back first and resent only if it does not hold the frame.
+ */
+bool Bootloader::writeFrame(quint32 addr, const char *frame, int size)
+{
+    for (int attempt = 0; !writeMemoryFrame(addr, frame, size); attempt++) {
+        if (attempt == FrameRetries || !resync())
+            return false;
+        if (frameLanded(addr, frame)) {
+            qDebug() << "Write Memory at" << Qt::hex << addr << "landed, only its reply was lost";
+            return true;
+        }
+        stats.retries++;
+        qDebug() << "Retry Write Memory at" << Qt::hex << addr;
+    }
+    return true;
+}
+
+bool Bootloader::frameLanded(quint32 addr, const char *frame)
+{
+    int size = uchar(frame[0]) + 1;
+    QByteArray flash;
+    return readMemory(addr, size, flash) && flash.size() >= size
+            && memcmp(flash.constData(), frame + 1, size) == 0;
+}
+
+bool Bootloader::writeMemory(quint32 addr, const char *data, int size)
+{
+    payload.clear();
+    payload.data(data, size, size);
+    return writeFrame(addr, payload.constData(), payload.size());
+}
+
+bool Bootloader::go(quint32 addr)
+{
+    if (!commands.isEmpty() && !commands.contains(GoCommand)) {
+        qDebug() << "Go command not offered by bootloader";
+        return false;
+    }
+
+    writeCmd(GoCommand);
+    if (!waitForAck())
+        return false;
+    writeAddr(addr);
+    return waitForAck(ackMsecs(5 + 1));
+}
+
+/*
+ * Upload the stub into SRAM with Write Memory, patch in the rate it should
+ * switch to, start it with Go and wait for it to answer a ping at that rate.
+ */
+bool Bootloader::startStub()
+{
+    QFile file(stubFilename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qDebug() << "Cannot open loader stub" << stubFilename << ":" << file.errorString();
+        return false;
+    }
+
+    QByteArray stub = file.readAll();
+    if (stub.size() < StubProtocol::ImageHeaderSize
+            || StubProtocol::get32(stub.constData() + StubProtocol::MagicOffset) != StubProtocol::ImageMagic
+            || StubProtocol::get32(stub.constData() + StubProtocol::VersionOffset) != StubProtocol::Version) {
+        qDebug() << stubFilename << "is not a loader stub for this protocol";
+        return false;
+    }
+
+    qint32 rate = stubBaudrate > 0 ? stubBaudrate : baudrate;
+    StubProtocol::put32(stub.data() + StubProtocol::BaudrateOffset, quint32(rate));
+    while (stub.size() % 4)
+        stub.append(char(0xff));
+
+    quint32 address = stubAddress ? stubAddress : chip.userRamAddress();
+    if (address < chip.userRamAddress() || address - chip.userRamAddress() + stub.size() > chip.userRamSize()) {
+        qDebug() << "Loader stub of" << stub.size() << "bytes at" << Qt::hex << address
+                 << "does not fit the free RAM from" << chip.userRamAddress();
+        return false;
+    }
+
+    for (int pos = 0; pos < stub.size(); pos += chip.maxWrite) {
+        if (!writeMemory(address + pos, stub.constData() + pos, qMin(chip.maxWrite, stub.size() - pos))) {
+            qDebug() << "Upload loader stub failed at" << Qt::hex << address + pos;
+            return false;
         }
+    }
+
+    if (!go(address)) {
+        qDebug() << "Go to loader stub failed, buffer:" << buffer.toHex();
+        return false;
+    }
+
+    transport->waitForBytesWritten(100);
+    if (rate != baudrate && !transport->setBaudRate(rate)) {
+        qDebug() << "Baudrate" << rate << "not supported by adapter";
+        return false;
+    }
+    parser.clear();
+
+    StubFrame ping;
+    ping.type = StubFrame::Ping;
+    for (int i = 0; i < StubRetries; i++) {
+        ping.seq = quint8(i);
+        send(StubProtocol::encode(ping));
+
+        StubFrame reply;
+        if (waitForStubFrame(reply, StubPingMsecs) && reply.type == (StubFrame::Ping | StubFrame::ReplyFlag)
+                && reply.payload.size() >= 4) {
+            stubWindow = qBound(1, int(StubProtocol::get16(reply.payload.constData())), 64);
+            stubBlockSize = qBound(BlockSize, int(StubProtocol::get16(reply.payload.constData() + 2)),
+                                   int(StubProtocol::MaxPayload)) / BlockSize * BlockSize;
+            qDebug() << "Loader stub running at" << rate << ", window:" << stubWindow << ", block:" << stubBlockSize;
+            stubRunning = true;
+            return true;
+        }
+        stats.retries++;
+    }
+
+    qDebug() << "Loader stub does not answer at" << rate;
+    return false;
+}
+
+bool Bootloader::waitForStubFrame(StubFrame &frame, int msec)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    forever {
+        bool valid;
+        int used;
+        while ((used = StubProtocol::decode(parser.data(), parser.bytesAvailable(), frame, valid)) > 0) {
+            parser.discard(used);
+            if (valid)
+                return true;
+            if (used > 1)
+                qDebug() << "Loader stub reply CRC error, seq" << frame.seq;
+        }
+
+        if (!readResponse(msec - timer.elapsed())) {
+            stats.timeouts++;
+            if (trace)
+                trace->mark("timeout");
+            return false;
+        }
+    }
+}
+
+QByteArray Bootloader::stubWriteFrame(const StubBlock &block, int index)
+{
+    StubFrame frame;
+    frame.seq = quint8(index);
+    frame.address = block.address;
+    frame.size = quint16(block.data.size());
+
+    const QByteArray &packed = Lz4Block::compress(block.data.constData(), block.data.size());
+    if (packed.size() < block.data.size()) {
+        frame.type = StubFrame::WriteLz4;
+        frame.payload = packed;
     } else {
-        qDebug() << "Auto-Baud rate sequence timeout";
+        frame.type = StubFrame::Write;
+        frame.payload = block.data;
     }
 
-    return ack;
+    return StubProtocol::encode(frame);
+}
+
+/*
+ * Long enough for a full window of uncompressed blocks to cross the wire
+ * plus the flash programming time of the oldest.
+ */
+int Bootloader::stubTimeout() const
+{
+    qint64 bits = qint64(stubWindow) * (stubBlockSize + StubProtocol::HeaderSize + StubProtocol::CrcSize) * BitsPerByte;
+    return StubFlashMsecs + int(bits * 1000 / qMax(transport->baudRate(), 1200));
+}
+
+/*
+ * Sliding window, go-back-N: up to stubWindow frames are in flight and are
+ * acknowledged in order by sequence number. A CRC error or a timeout
+ * resends from the oldest unacknowledged frame. The stub programs every
+ * frame it receives intact, and F0/F1/F3/L1 refuse to program a half-word
+ * that is not erased, so the frames in flight are checksummed first and
+ * only those whose block does not hold the data yet are sent again.
+ */
+bool Bootloader::stubWrite(const QList<StubBlock> &blocks, int &written, int total)
+{
+    QVector<QByteArray> frames(blocks.size());
+    QBitArray landed(blocks.size());
+    qint64 raw = 0;
+    qint64 packed = 0;
+    int base = 0;
+    int next = 0;
+    int failures = 0;
+    int timeout = stubTimeout();
+
+    while (base < blocks.size()) {
+        if (landed.testBit(base)) {
+            written += blocks.at(base).data.size();
+            confirm(blocks.at(base).address + blocks.at(base).data.size());
+            emit progressValue(qMin(100, 80 * written / total + 20));
+            base++;
+            next = qMax(next, base);
+            continue;
+        }
+
+        while (next < blocks.size() && next - base < stubWindow) {
+            if (landed.testBit(next)) {
+                next++;
+                continue;
+            }
+            reserve(blocks.at(next).address + blocks.at(next).data.size());
+            if (frames.at(next).isEmpty()) {
+                frames[next] = stubWriteFrame(blocks.at(next), next);
+                raw += blocks.at(next).data.size();
+                packed += frames.at(next).size();
+            }
+            send(frames.at(next));
+            next++;
+        }
+
+        StubFrame reply;
+        if (!waitForStubFrame(reply, timeout)) {
+            qDebug() << "Loader stub write timeout at" << Qt::hex << blocks.at(base).address;
+        } else if ((reply.type != (StubFrame::Write | StubFrame::ReplyFlag)
+                    && reply.type != (StubFrame::WriteLz4 | StubFrame::ReplyFlag))
+                   || reply.seq != quint8(base)) {
+            continue;
+        } else if (reply.status == StubFrame::Ok) {
+            landed.setBit(base);
+            failures = 0;
+            continue;
+        } else if (reply.status != StubFrame::CrcError) {
+            qDebug() << "Loader stub write failed at" << Qt::hex << blocks.at(base).address << ", status" << reply.status;
+            return false;
+        }
+
+        if (++failures > StubRetries)
+            return false;
+        stats.retries++;
+        for (int i = base; i < next; i++) {
+            quint32 crc;
+            const StubBlock &block = blocks.at(i);
+            if (!landed.testBit(i) && stubChecksum(block, i, crc)
+                    && crc == FirmwareImage::crc32(block.data.constData(), block.data.size()))
+                landed.setBit(i);
+        }
+        next = base;
+    }
+
+    qDebug() << "Loader stub wrote" << raw << "bytes in" << packed << "bytes of frames";
+    return true;
+}
+
+/*
+ * CRC of the flash under block, as the stub computes it. Replies to other
+ * requests still in flight are skipped.
+ */
+bool Bootloader::stubChecksum(const StubBlock &block, int index, quint32 &crc)
+{
+    StubFrame request;
+    request.type = StubFrame::Checksum;
+    request.seq = quint8(index);
+    request.address = block.address;
+    request.size = quint16(block.data.size());
+    const QByteArray &frame = StubProtocol::encode(request);
+
+    StubFrame reply;
+    bool answered = false;
+    for (int attempt = 0; !answered && attempt <= StubRetries; attempt++) {
+        if (attempt > 0)
+            stats.retries++;
+        send(frame);
+        while (waitForStubFrame(reply, StubFlashMsecs)) {
+            if (reply.type == (StubFrame::Checksum | StubFrame::ReplyFlag) && reply.seq == request.seq) {
+                answered = reply.status != StubFrame::CrcError;
+                break;
+            }
+        }
+    }
+
+    if (!answered || reply.status != StubFrame::Ok || reply.payload.size() < 4)
+        return false;
+    crc = StubProtocol::get32(reply.payload.constData());
+    return true;
+}
+
+bool Bootloader::stubVerify(const QList<StubBlock> &blocks, int &written, int total)
+{
+    for (int i = 0; i < blocks.size(); i++) {
+        const StubBlock &block = blocks.at(i);
+        quint32 crc;
+        if (!stubChecksum(block, i, crc)) {
+            qDebug() << "Loader stub checksum failed at" << Qt::hex << block.address;
+            return false;
+        }
+
+        if (crc != FirmwareImage::crc32(block.data.constData(), block.data.size())) {
+            qDebug() << "Verify failed in block at" << Qt::hex << block.address;
+            return false;
+        }
+        written += block.data.size();
+        emit progressValue(qMin(100, 80 * written / total + 20));
+    }
+
+    return true;
+}
+
+bool Bootloader::stubExit(quint32 addr)
+{
+    StubFrame request;
+    request.type = StubFrame::Exit;
+    request.address = addr;
+    send(StubProtocol::encode(request));
+    stubRunning = false;
+
+    StubFrame reply;
+    return waitForStubFrame(reply, StubPingMsecs) && reply.status == StubFrame::Ok;
+}
+
+/*
+ * Go to the vector table at the start of flash does what a reset into the
+ * application would, minus the reset: the console can attach as soon as
+ * the port is released instead of pulsing RTS and waiting for boot.
+ */
+void Bootloader::leaveBootloader()
+{
+    enterPhase(ExitPhase);
+
+    quint32 addr = runApplication ? chip.flashAddress() : 0;
+    if (stubRunning) {
+        started = stubExit(addr) && addr;
+    } else if (runApplication) {
+        started = go(addr);
+        if (!started)
+            qDebug() << "Go to application failed, buffer:" << buffer.toHex();
+    }
+
+    bootModeExit();
 }
@@ -24,14 +24,75 @@
 
 #include <QThread>
 #include <QMap>
+#include <QList>
+#include <QElapsedTimer>
+#include <QJsonObject>
 
-class QSerialPort;
+#include "responseparser.h"
+#include "stubprotocol.h"
+#include "imagecache.h"
+#include "chipdatabase.h"
+#include "devicestore.h"
+#include "imagepreparer.h"
+#include "frameencoder.h"
+
+class Transport;
+class QBitArray;
+class WireTrace;
+
+struct SessionStats
+{
+    enum {
+        HistogramBuckets = 24
+    };
+
+    SessionStats() :
+        bytesSent(0),
+        bytesReceived(0),
+        retries(0),
+        transactions(0),
+        nacks(0),
+        timeouts(0),
+        totalNsecs(0),
+        maxNsecs(0)
+    {
+        for (int i = 0; i < HistogramBuckets; i++)
+            histogram[i] = 0;
+    }
+
+    qint64 bytesSent;
+    qint64 bytesReceived;
+    int retries;
+    int transactions;
+    int nacks;
+    int timeouts;
+    qint64 totalNsecs;
+    qint64 maxNsecs;
+    // bucket i counts ACK waits below 2^(i+1) us and not below 2^i us
+    int histogram[HistogramBuckets];
+};
 
 class Bootloader : public QThread
 {
     Q_OBJECT
 
 public:
+    enum Phase {
+        OpenPhase,
+        BootEntryPhase,
+        SyncPhase,
+        IdentifyPhase,
+        LoadPhase,
+        ComparePhase,
+        ErasePhase,
+        StubPhase,
+        WritePhase,
+        VerifyPhase,
+        ReadPhase,
+        ExitPhase,
+        PhaseCount
+    };
+
     explicit Bootloader(QObject *parent = 0);
     ~Bootloader();
 
@@ -45,45 +106,265 @@ public:
         this->baudrate = baudrate;
     }
 
+    void setBaudrates(const QList<qint32> &baudrates)
+    {
+        this->baudrates = baudrates;
+    }
+
     void setFilename(const QString &filename)
     {
         this->filename = filename;
     }
 
+    void setImage(const ImageHandle &image)
+    {
+        this->image = image;
+    }
+
+    void setDifferential(bool differential)
+    {
+        this->differential = differential;
+    }
+
+    void setVerify(bool verify)
+    {
+        this->verify = verify;
+    }
+
+    void setMassErase(bool massErase)
+    {
+        this->massErase = massErase;
+    }
+
+    void setSkipFlashed(bool skipFlashed)
+    {
+        this->skipFlashed = skipFlashed;
+    }
+
+    void setReadoutFilename(const QString &readoutFilename)
+    {
+        this->readoutFilename = readoutFilename;
+    }
+
+    void setReadoutAddress(quint32 readoutAddress)
+    {
+        this->readoutAddress = readoutAddress;
+    }
+
+    void setReadoutSize(quint32 readoutSize)
+    {
+        this->readoutSize = readoutSize;
+    }
+
+    void setRunApplication(bool runApplication)
+    {
+        this->runApplication = runApplication;
+    }
+
+    /* Keep a journal per port and UID and continue an interrupted write. */
+    void setResume(bool resume)
+    {
+        this->resume = resume;
+    }
+
+    void setStubFilename(const QString &stubFilename)
+    {
+        this->stubFilename = stubFilename;
+    }
+
+    void setStubBaudrate(qint32 stubBaudrate)
+    {
+        this->stubBaudrate = stubBaudrate;
+    }
+
+    /* 0 places the stub right after the RAM the ROM bootloader uses. */
+    void setStubAddress(quint32 stubAddress)
+    {
+        this->stubAddress = stubAddress;
+    }
+
+    void setTraceFile(const QString &traceFile)
+    {
+        this->traceFile = traceFile;
+    }
+
     void progressRange(int &minimum, int &maximum)
     {
         minimum = 0;
         maximum = 100;
     }
 
+    const SessionStats &sessionStats() const
+    {
+        return stats;
+    }
+
+    QJsonObject report() const;
+
+    bool isSucceeded() const
+    {
+        return success;
+    }
+
+    bool applicationStarted() const
+    {
+        return started;
+    }
+
+    bool isReadout() const
+    {
+        return !readoutFilename.isEmpty();
+    }
+
+    qint64 elapsedMsecs() const
+    {
+        return elapsed;
+    }
+
+    QString port() const
+    {
+        return portName;
+    }
+
+    qint32 currentBaudrate() const
+    {
+        return baudrate;
+    }
+
+    Phase phase() const
+    {
+        return currentPhase;
+    }
+
+    qint64 phaseNsecs(Phase phase) const
+    {
+        return phaseTimes[phase];
+    }
+
+    static const char *phaseName(Phase phase);
+
+    void setOptions(const Bootloader *other);
+
 Q_SIGNALS:
     void progressValue(int value);
+    void baudrateNegotiated(qint32 baudrate);
+    void completed(bool success, qint64 msecs);
+    void reported(const QJsonObject &report);
+    void portReleased();
 
 protected:
     virtual void run();
 
 private:
+    struct StubBlock
+    {
+        quint32 address;
+        QByteArray data;
+    };
+
+    void session();
+    void enterPhase(Phase phase);
     bool openSerial();
     void closeSerial();
     void bootModeEnter();
     void bootModeExit();
+    bool comparePages(const FirmwareImage &firmware, QBitArray &dirty);
+    bool sampleMatches(const ImageHandle &cached);
+    void reserve(quint32 end);
+    void confirm(quint32 end);
+    void dropJournal();
+    bool nextWrite(const ImageHandle &cached, const QBitArray &dirty, quint32 from, quint32 &addr);
+    bool resumePoint(const ImageHandle &cached, const QBitArray &dirty, quint32 &from);
+    static int firstMismatch(const QByteArray &bin, int pos, const QByteArray &flash);
     char checkSum(const QByteArray &data);
     qint64 write(char ch);
     qint64 writeCmd(char ch);
     qint64 writeAddr(quint32 addr);
-    qint64 writeBytesRead(char size);
-    qint64 writeData(const QByteArray &data);
+    qint64 send(const char *data, qint64 size);
+    qint64 send(const QByteArray &data);
+    qint64 send(const FrameEncoder &frame);
+    bool readMemory(quint32 addr, int size, QByteArray &data);
+    bool readMemoryFrame(quint32 addr, int size, QByteArray &data);
     bool waitForRead(int msec);
-    bool waitForAck(int msec = 50);
+    bool readResponse(qint64 msec);
+    bool waitForAck(int msec = 0);
+    bool waitForBytes(int size, QByteArray &data, int msec = 0);
+    int ackMsecs(int bytes) const;
+    void sampleRtt(const QElapsedTimer &timer);
+    bool resync();
     bool autoBaudrateSeq();
+    bool getVersion();
+    bool getCommands();
+    bool erasePages(const QList<int> &pages);
+    int eraseMsecs(int sector) const;
+    bool eraseBanks(QList<int> &pages);
+    bool eraseMass();
+    bool eraseSpecial(quint16 code, int msecs);
+    bool negotiateBaudrate();
+    bool readout();
+    bool writeMemory(quint32 addr, const char *data, int size);
+    bool writeFrame(quint32 addr, const char *frame, int size);
+    bool writeMemoryFrame(quint32 addr, const char *frame, int size);
+    bool frameLanded(quint32 addr, const char *frame);
+    bool go(quint32 addr);
+    bool startStub();
+    bool waitForStubFrame(StubFrame &frame, int msec);
+    QByteArray stubWriteFrame(const StubBlock &block, int index);
+    int stubTimeout() const;
+    bool stubWrite(const QList<StubBlock> &blocks, int &written, int total);
+    bool stubChecksum(const StubBlock &block, int index, quint32 &crc);
+    bool stubVerify(const QList<StubBlock> &blocks, int &written, int total);
+    bool stubExit(quint32 addr);
+    void leaveBootloader();
 
 private:
     QString portName;
     qint32 baudrate;
+    QList<qint32> baudrates;
     QString filename;
-    QSerialPort *serialPort;
+    ImageHandle image;
+    ImagePreparer preparer;
+    bool differential;
+    bool verify;
+    bool massErase;
+    bool skipFlashed;
+    bool runApplication;
+    bool resume;
+    QString readoutFilename;
+    quint32 readoutAddress;
+    quint32 readoutSize;
+    qint64 readoutBytes;
+    qint64 readoutNsecs;
+    QString stubFilename;
+    qint32 stubBaudrate;
+    quint32 stubAddress;
+    int stubWindow;
+    int stubBlockSize;
+    QString traceFile;
+    WireTrace *trace;
+    Transport *transport;
+    FrameEncoder control;
+    FrameEncoder payload;
     QByteArray buffer;
-    static QMap<int, int> densityMap;
+    QByteArray commands;
+    ChipInfo chip;
+    ResponseParser parser;
+    SessionStats stats;
+    qint64 rttNsecs;
+    qint64 rttSample;
+    FlashJournal journal;
+    QByteArray journalUid;
+    bool journaling;
+    bool resumed;
+    quint32 sentEnd;
+    bool success;
+    bool started;
+    bool stubRunning;
+    qint64 elapsed;
+    Phase currentPhase;
+    QElapsedTimer phaseTimer;
+    qint64 phaseStart;
+    qint64 phaseTimes[PhaseCount];
 };
 
 #endif // BOOTLOADER_H
@@ -0,0 +1,40 @@
+QT += serialport network
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+SOURCES += $$PWD/bootloader.cpp \
+    $$PWD/responseparser.cpp \
+    $$PWD/firmwareimage.cpp \
+    $$PWD/imagecache.cpp \
+    $$PWD/devicestore.cpp \
+    $$PWD/wiretrace.cpp \
+    $$PWD/stubprotocol.cpp \
+    $$PWD/lz4block.cpp \
+    $$PWD/imagewriter.cpp \
+    $$PWD/chipdatabase.cpp \
+    $$PWD/imagepreparer.cpp \
+    $$PWD/frameencoder.cpp \
+    $$PWD/transport.cpp \
+    $$PWD/serialtransport.cpp \
+    $$PWD/tcptransport.cpp
+
+HEADERS += $$PWD/bootloader.h \
+    $$PWD/responseparser.h \
+    $$PWD/firmwareimage.h \
+    $$PWD/imagecache.h \
+    $$PWD/devicestore.h \
+    $$PWD/wiretrace.h \
+    $$PWD/stubprotocol.h \
+    $$PWD/lz4block.h \
+    $$PWD/imagewriter.h \
+    $$PWD/chipdatabase.h \
+    $$PWD/imagepreparer.h \
+    $$PWD/frameencoder.h \
+    $$PWD/transport.h \
+    $$PWD/serialtransport.h \
+    $$PWD/ptytransport.h \
+    $$PWD/tcptransport.h \
+    $$PWD/qtcompat.h
+
+unix: SOURCES += $$PWD/ptytransport.cpp
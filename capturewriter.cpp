@@ -0,0 +1,130 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <QDateTime>
+#include <QMutexLocker>
+
+#include "capturewriter.h"
+
+CaptureWriter::CaptureWriter(QObject *parent) :
+    QThread(parent),
+    capturing(false),
+    stopping(false),
+    timestamps(false),
+    lineStart(true)
+{
+
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    close();
+}
+
+bool CaptureWriter::open(const QString &filename, bool timestamps)
+{
+    close();
+
+    file.setFileName(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append))
+        return false;
+
+    front.reserve(BlockSize);
+    back.reserve(BlockSize);
+    this->timestamps = timestamps;
+    lineStart = true;
+    stopping = false;
+    capturing = true;
+    start(QThread::LowPriority);
+    return true;
+}
+
+void CaptureWriter::close()
+{
+    if (!capturing)
+        return;
+
+    mutex.lock();
+    stopping = true;
+    wakeup.wakeOne();
+    mutex.unlock();
+    wait();
+
+    file.close();
+    capturing = false;
+}
+
+/*
+ * Host timestamps mark when a chunk arrived, so they are taken here on the
+ * GUI thread rather than when the writer gets round to the block.
+ */
+void CaptureWriter::write(const char *data, int size)
+{
+    if (!capturing)
+        return;
+
+    QMutexLocker locker(&mutex);
+    if (stopping)
+        return;
+
+    if (!timestamps) {
+        front.append(data, size);
+    } else {
+        const QByteArray &stamp = QDateTime::currentDateTime().toString("[yyyy-MM-dd hh:mm:ss.zzz] ").toLatin1();
+        for (int i = 0; i < size; i++) {
+            if (lineStart)
+                front.append(stamp);
+            front.append(data[i]);
+            lineStart = data[i] == '\n';
+        }
+    }
+
+    if (front.size() >= BlockSize)
+        wakeup.wakeOne();
+}
+
+void CaptureWriter::run()
+{
+    bool done = false;
+
+    while (!done) {
+        mutex.lock();
+        if (!stopping && front.size() < BlockSize)
+            wakeup.wait(&mutex, FlushMsecs);
+        done = stopping;
+        front.swap(back);
+        mutex.unlock();
+
+        if (back.isEmpty())
+            continue;
+
+        if (file.write(back) != back.size()) {
+            mutex.lock();
+            stopping = true;
+            front.resize(0);
+            mutex.unlock();
+            emit failed(file.errorString());
+            done = true;
+        }
+        file.flush();
+        back.resize(0);
+    }
+}
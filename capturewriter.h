@@ -0,0 +1,80 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef CAPTUREWRITER_H
+#define CAPTUREWRITER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QFile>
+
+/*
+ * Streams console bytes to a file. The GUI thread only copies into the
+ * front block under a short lock; the writer thread swaps it with the back
+ * block and does the file I/O, so a slow disk never stalls the console.
+ */
+class CaptureWriter : public QThread
+{
+    Q_OBJECT
+
+public:
+    explicit CaptureWriter(QObject *parent = 0);
+    ~CaptureWriter();
+
+    bool open(const QString &filename, bool timestamps);
+    void close();
+    void write(const char *data, int size);
+
+    bool isCapturing() const
+    {
+        return capturing;
+    }
+
+    QString errorString() const
+    {
+        return file.errorString();
+    }
+
+Q_SIGNALS:
+    void failed(const QString &error);
+
+protected:
+    virtual void run();
+
+private:
+    enum {
+        BlockSize = 64 * 1024,
+        FlushMsecs = 250
+    };
+
+    QFile file;
+    QMutex mutex;
+    QWaitCondition wakeup;
+    QByteArray front;
+    QByteArray back;
+    bool capturing;
+    bool stopping;
+    bool timestamps;
+    bool lineStart;
+};
+
+#endif // CAPTUREWRITER_H
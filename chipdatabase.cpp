@@ -0,0 +1,308 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <QDebug>
+#include <QFile>
+#include <QSettings>
+#include <QStringList>
+
+#include "qtcompat.h"
+#include "chipdatabase.h"
+
+/*
+ * Families the bootloader has always known, plus the F2/F4/F7 parts with
+ * mixed sector sizes. RAM sizes are those of the smallest part sharing the
+ * product ID; the reservation is the RAM the ROM bootloader itself uses.
+ */
+static const struct {
+    int chipId;
+    const char *name;
+    const char *flash;
+    quint32 ramSize;
+    quint32 bootloaderRam;
+    quint32 flashSizeRegister;
+    quint32 uniqueIdAddress;
+} DefaultChips[] = {
+    { 0x412, "STM32F10x low-density", "0x08000000:32*1K", 0x1000, 0x200, 0x1ffff7e0, 0x1ffff7e8 },
+    { 0x410, "STM32F10x medium-density", "0x08000000:128*1K", 0x2800, 0x200, 0x1ffff7e0, 0x1ffff7e8 },
+    { 0x414, "STM32F10x high-density", "0x08000000:256*2K", 0x8000, 0x200, 0x1ffff7e0, 0x1ffff7e8 },
+    { 0x418, "STM32F105/107", "0x08000000:128*2K", 0x10000, 0x1000, 0x1ffff7e0, 0x1ffff7e8 },
+    { 0x420, "STM32F100 value line", "0x08000000:128*1K", 0x1000, 0x200, 0x1ffff7e0, 0x1ffff7e8 },
+    { 0x428, "STM32F100 high-density value line", "0x08000000:256*2K", 0x6000, 0x200, 0x1ffff7e0, 0x1ffff7e8 },
+    { 0x430, "STM32F10x XL-density", "0x08000000:256*2K|0x08080000:256*2K", 0xc000, 0x800, 0x1ffff7e0, 0x1ffff7e8 },
+    { 0x416, "STM32L1 cat.1", "0x08000000:512*256", 0x4000, 0x1000, 0x1ff8004c, 0x1ff80050 },
+    { 0x436, "STM32L1 cat.3", "0x08000000:1536*256", 0x8000, 0x1000, 0x1ff800cc, 0x1ff800d0 },
+    { 0x411, "STM32F2xx", "0x08000000:4*16K,64K,7*128K", 0x20000, 0x2000, 0x1fff7a22, 0x1fff7a10 },
+    { 0x413, "STM32F405/407/415/417", "0x08000000:4*16K,64K,7*128K", 0x20000, 0x3000, 0x1fff7a22, 0x1fff7a10 },
+    { 0x419, "STM32F42x/43x", "0x08000000:4*16K,64K,7*128K|0x08100000:4*16K,64K,7*128K",
+      0x30000, 0x3000, 0x1fff7a22, 0x1fff7a10 },
+    { 0x423, "STM32F401xB/C", "0x08000000:4*16K,64K,128K", 0x10000, 0x3000, 0x1fff7a22, 0x1fff7a10 },
+    { 0x433, "STM32F401xD/E", "0x08000000:4*16K,64K,3*128K", 0x18000, 0x3000, 0x1fff7a22, 0x1fff7a10 },
+    { 0x431, "STM32F411", "0x08000000:4*16K,64K,3*128K", 0x20000, 0x3000, 0x1fff7a22, 0x1fff7a10 },
+    { 0x421, "STM32F446", "0x08000000:4*16K,64K,3*128K", 0x20000, 0x3000, 0x1fff7a22, 0x1fff7a10 },
+    { 0x449, "STM32F74x/75x", "0x08000000:4*32K,128K,3*256K", 0x50000, 0x4000, 0x1ff0f442, 0x1ff0f420 },
+    { 0x451, "STM32F76x/77x", "0x08000000:4*32K,128K,7*256K", 0x80000, 0x4000, 0x1ff0f442, 0x1ff0f420 },
+};
+
+const quint32 DefaultRamAddress = 0x20000000;
+const int DefaultMaxWrite = 256;
+
+ChipInfo::ChipInfo() :
+    chipId(0),
+    ramAddress(DefaultRamAddress),
+    ramSize(0),
+    bootloaderRam(0),
+    maxWrite(DefaultMaxWrite),
+    flashSizeRegister(0),
+    uniqueIdAddress(0)
+{
+
+}
+
+quint32 ChipInfo::flashSize() const
+{
+    quint32 size = 0;
+    foreach (const Sector &sector, sectors)
+        size += sector.size;
+    return size;
+}
+
+int ChipInfo::sectorAt(quint32 address) const
+{
+    int low = 0;
+    int high = sectors.size() - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        const Sector &sector = sectors.at(mid);
+        if (address < sector.address)
+            high = mid - 1;
+        else if (address - sector.address >= sector.size)
+            low = mid + 1;
+        else
+            return mid;
+    }
+    return -1;
+}
+
+/*
+ * Sectors an erase of [begin, end) has to touch, or none when part of the
+ * range lies outside flash.
+ */
+QList<int> ChipInfo::sectorsFor(quint32 begin, quint32 end) const
+{
+    QList<int> list;
+    if (begin >= end)
+        return list;
+
+    int first = sectorAt(begin);
+    int last = sectorAt(end - 1);
+    if (first < 0 || last < 0)
+        return list;
+
+    for (int i = first; i <= last; i++) {
+        if (i > first && sectors.at(i).address != sectors.at(i - 1).address + sectors.at(i - 1).size) {
+            list.clear();
+            return list;
+        }
+        list.append(i);
+    }
+    return list;
+}
+
+void ChipInfo::truncate(quint32 size)
+{
+    quint32 end = flashAddress() + size;
+    while (!sectors.isEmpty() && sectors.last().address >= end)
+        sectors.removeLast();
+    while (!banks.isEmpty() && banks.last() >= sectors.size())
+        banks.removeLast();
+}
+
+bool ChipInfo::parseFlash(const QString &layout)
+{
+    QList<Sector> list;
+    QList<int> firsts;
+
+    foreach (const QString &bank, layout.split('|', Qt::SkipEmptyParts)) {
+        int colon = bank.indexOf(':');
+        if (colon < 0)
+            return false;
+        bool ok;
+        quint32 address = bank.left(colon).trimmed().toUInt(&ok, 0);
+        if (!ok)
+            return false;
+        firsts.append(list.size());
+        if (!parseSectors(bank.mid(colon + 1), address, list))
+            return false;
+    }
+
+    if (list.isEmpty())
+        return false;
+    for (int i = 1; i < list.size(); i++) {
+        if (list.at(i).address < list.at(i - 1).address + list.at(i - 1).size)
+            return false;
+    }
+
+    sectors = list;
+    banks = firsts;
+    return true;
+}
+
+/*
+ * Append the sectors of "4*16K,64K,7*128K" starting at address.
+ */
+bool ChipInfo::parseSectors(const QString &spec, quint32 address, QList<Sector> &sectors)
+{
+    foreach (const QString &item, spec.split(',', Qt::SkipEmptyParts)) {
+        int count = 1;
+        QString size = item.trimmed();
+        int star = size.indexOf('*');
+        if (star >= 0) {
+            bool ok;
+            count = size.left(star).toInt(&ok);
+            if (!ok || count <= 0)
+                return false;
+            size = size.mid(star + 1);
+        }
+
+        bool ok;
+        Sector sector;
+        sector.size = parseSize(size, &ok);
+        if (!ok || sector.size == 0)
+            return false;
+        for (int i = 0; i < count; i++) {
+            sector.address = address;
+            sectors.append(sector);
+            address += sector.size;
+        }
+    }
+    return true;
+}
+
+quint32 ChipInfo::parseSize(const QString &text, bool *ok)
+{
+    QString value = text.trimmed().toUpper();
+    quint32 scale = 1;
+    if (value.endsWith('K')) {
+        scale = 1024;
+        value.chop(1);
+    } else if (value.endsWith('M')) {
+        scale = 1024 * 1024;
+        value.chop(1);
+    }
+    return value.toUInt(ok, 0) * scale;
+}
+
+/*
+ * QSettings hands back an unquoted value with commas as a string list.
+ */
+static QString text(const QVariant &value)
+{
+    return value.type() == QVariant::StringList ? value.toStringList().join(",") : value.toString();
+}
+
+ChipDatabase::ChipDatabase()
+{
+    loadDefaults();
+
+    if (QFile::exists("chips.ini")) {
+        QString error;
+        if (!load("chips.ini", &error))
+            qDebug() << "chips.ini:" << error;
+    }
+}
+
+ChipDatabase *ChipDatabase::instance()
+{
+    static ChipDatabase database;
+    return &database;
+}
+
+void ChipDatabase::loadDefaults()
+{
+    for (size_t i = 0; i < sizeof(DefaultChips) / sizeof(DefaultChips[0]); i++) {
+        ChipInfo chip;
+        chip.chipId = DefaultChips[i].chipId;
+        chip.name = DefaultChips[i].name;
+        chip.parseFlash(DefaultChips[i].flash);
+        chip.ramSize = DefaultChips[i].ramSize;
+        chip.bootloaderRam = DefaultChips[i].bootloaderRam;
+        chip.flashSizeRegister = DefaultChips[i].flashSizeRegister;
+        chip.uniqueIdAddress = DefaultChips[i].uniqueIdAddress;
+        chips.insert(chip.chipId, chip);
+    }
+}
+
+bool ChipDatabase::load(const QString &filename, QString *error)
+{
+    QSettings settings(filename, QSettings::IniFormat);
+    if (settings.status() != QSettings::NoError) {
+        *error = "cannot parse file";
+        return false;
+    }
+
+    foreach (const QString &group, settings.childGroups()) {
+        bool ok;
+        int chipId = group.toInt(&ok, 0);
+        if (!ok) {
+            *error = QString("bad product ID [%1]").arg(group);
+            return false;
+        }
+
+        ChipInfo chip = chips.value(chipId);
+        chip.chipId = chipId;
+        settings.beginGroup(group);
+        if (settings.contains("Name"))
+            chip.name = text(settings.value("Name"));
+        if (settings.contains("Flash") && !chip.parseFlash(text(settings.value("Flash")))) {
+            *error = QString("bad Flash layout in [%1]").arg(group);
+            return false;
+        }
+        if (settings.contains("Ram")) {
+            QString ram = text(settings.value("Ram"));
+            int colon = ram.indexOf(':');
+            bool sizeOk;
+            ok = true;
+            chip.ramAddress = colon < 0 ? DefaultRamAddress : ram.left(colon).trimmed().toUInt(&ok, 0);
+            chip.ramSize = ChipInfo::parseSize(ram.mid(colon + 1), &sizeOk);
+            if (!ok || !sizeOk) {
+                *error = QString("bad Ram range in [%1]").arg(group);
+                return false;
+            }
+        }
+        if (settings.contains("BootloaderRam"))
+            chip.bootloaderRam = ChipInfo::parseSize(text(settings.value("BootloaderRam")));
+        chip.maxWrite = qBound(4, settings.value("MaxWrite", chip.maxWrite).toInt(), DefaultMaxWrite) & ~3;
+        chip.flashSizeRegister = settings.value("FlashSizeRegister", QString::number(chip.flashSizeRegister))
+                .toString().toUInt(0, 0);
+        chip.uniqueIdAddress = settings.value("UniqueId", QString::number(chip.uniqueIdAddress))
+                .toString().toUInt(0, 0);
+        settings.endGroup();
+
+        if (!chip.isValid()) {
+            *error = QString("no Flash layout for [%1]").arg(group);
+            return false;
+        }
+        chips.insert(chipId, chip);
+    }
+
+    return true;
+}
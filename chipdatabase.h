@@ -0,0 +1,128 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef CHIPDATABASE_H
+#define CHIPDATABASE_H
+
+#include <QMap>
+#include <QList>
+#include <QString>
+
+/*
+ * Memory layout of one product ID. Sectors are listed in erase order across
+ * all banks, so a sector's index is the page number Erase expects; banks
+ * holds the index of each bank's first sector.
+ */
+struct ChipInfo
+{
+    struct Sector
+    {
+        quint32 address;
+        quint32 size;
+    };
+
+    ChipInfo();
+
+    bool isValid() const
+    {
+        return !sectors.isEmpty();
+    }
+
+    quint32 flashAddress() const
+    {
+        return sectors.isEmpty() ? 0 : sectors.first().address;
+    }
+
+    quint32 flashSize() const;
+    int sectorAt(quint32 address) const;
+    QList<int> sectorsFor(quint32 begin, quint32 end) const;
+    void truncate(quint32 size);
+
+    quint32 userRamAddress() const
+    {
+        return ramAddress + bootloaderRam;
+    }
+
+    quint32 userRamSize() const
+    {
+        return ramSize > bootloaderRam ? ramSize - bootloaderRam : 0;
+    }
+
+    bool parseFlash(const QString &layout);
+    static bool parseSectors(const QString &spec, quint32 address, QList<Sector> &sectors);
+    static quint32 parseSize(const QString &text, bool *ok = 0);
+
+    int chipId;
+    QString name;
+    QList<Sector> sectors;
+    QList<int> banks;
+    quint32 ramAddress;
+    quint32 ramSize;
+    quint32 bootloaderRam;
+    int maxWrite;
+    quint32 flashSizeRegister;
+    quint32 uniqueIdAddress;
+};
+
+/*
+ * Known parts, from the compiled-in table overlaid with chips.ini when it
+ * exists. Each section of the file is a product ID in hex, e.g.
+ *
+ *   [0x413]
+ *   Name=STM32F405/407
+ *   Flash=0x08000000:4*16K,64K,7*128K
+ *   Ram=0x20000000:128K
+ *   BootloaderRam=12K
+ *   MaxWrite=256
+ *   FlashSizeRegister=0x1fff7a22
+ *   UniqueId=0x1fff7a10
+ *
+ * Banks are separated by '|' in Flash; QSettings would take ';' for the
+ * start of a comment. Keys left out of an override keep their compiled-in
+ * value.
+ */
+class ChipDatabase
+{
+public:
+    static ChipDatabase *instance();
+
+    ChipInfo chip(int chipId) const
+    {
+        return chips.value(chipId);
+    }
+
+    bool contains(int chipId) const
+    {
+        return chips.contains(chipId);
+    }
+
+private:
+    ChipDatabase();
+    Q_DISABLE_COPY(ChipDatabase)
+
+    void loadDefaults();
+    bool load(const QString &filename, QString *error);
+
+private:
+    QMap<int, ChipInfo> chips;
+};
+
+#endif // CHIPDATABASE_H
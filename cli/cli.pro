@@ -0,0 +1,17 @@
+#-------------------------------------------------
+#
+# Headless command line flasher
+#
+#-------------------------------------------------
+
+QT       += core
+QT       -= gui
+
+TARGET = stm32bootloader-cli
+TEMPLATE = app
+CONFIG   += console
+CONFIG   -= app_bundle
+
+SOURCES += main.cpp
+
+include(../bootloader.pri)
@@ -0,0 +1,231 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <algorithm>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStringList>
+#include <QTextStream>
+
+#include "bootloader.h"
+#include "qtcompat.h"
+
+enum ExitCode {
+    ExitSuccess = 0,
+    ExitUsage = 1,
+    ExitPhaseBase = 10
+};
+
+static QString exitCodes()
+{
+    QString text("Exit codes:\n"
+                 "  0   success\n"
+                 "  1   usage error\n");
+    for (int i = 0; i < Bootloader::PhaseCount; i++) {
+        text += QString("  %1  %2 phase failed\n")
+                .arg(ExitPhaseBase + i)
+                .arg(Bootloader::phaseName(Bootloader::Phase(i)));
+    }
+    return text;
+}
+
+/*
+ * Nearest-rank percentiles over the runs of a benchmark, so each reported
+ * value is a time that was actually measured.
+ */
+static QJsonObject distribution(QList<double> samples)
+{
+    QJsonObject object;
+    if (samples.isEmpty())
+        return object;
+
+    std::sort(samples.begin(), samples.end());
+    const int percentiles[] = { 50, 90, 99 };
+    object.insert("min", samples.first());
+    for (unsigned int i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+        int rank = (percentiles[i] * samples.size() + 99) / 100;
+        object.insert(QString("p%1").arg(percentiles[i]), samples.at(qMax(rank, 1) - 1));
+    }
+    object.insert("max", samples.last());
+    return object;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("stm32bootloader-cli");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Flash an STM32 through its UART bootloader and print a JSON report.\n\n" + exitCodes());
+    parser.addHelpOption();
+
+    QCommandLineOption portOption(QStringList() << "p" << "port",
+                                  "Serial port name, pty:<path> or tcp://<host>:<port>.", "port");
+    QCommandLineOption baudrateOption(QStringList() << "b" << "baudrate",
+                                      "Baudrate, or a comma separated ladder tried from first to last.", "baudrate", "115200");
+    QCommandLineOption imageOption(QStringList() << "i" << "image",
+                                   "Firmware image to program.", "file");
+    QCommandLineOption modeOption(QStringList() << "m" << "mode",
+                                  "Programming mode: full or differential.", "mode", "full");
+    QCommandLineOption verifyOption("verify",
+                                    "Read back and compare programmed blocks.");
+    QCommandLineOption massEraseOption("mass-erase",
+                                       "Erase the whole flash instead of the pages the image covers.");
+    QCommandLineOption skipFlashedOption("skip-flashed",
+                                         "Skip devices whose unique ID is recorded with this image.");
+    QCommandLineOption readOption("read",
+                                  "Read flash back into a .bin or .hex file instead of programming.", "file");
+    QCommandLineOption addressOption("address",
+                                     "Start address for --read.", "address", "0x08000000");
+    QCommandLineOption lengthOption("length",
+                                    "Bytes to read; defaults to the flash size the part reports.", "bytes", "0");
+    QCommandLineOption runOption("run",
+                                 "Start the application with Go after programming instead of leaving it in the bootloader.");
+    QCommandLineOption resumeOption("resume",
+                                    "Journal the write and continue an interrupted session on this port and device.");
+    QCommandLineOption repeatOption("repeat",
+                                    "Run the session N times and print a summary with percentiles.", "N", "1");
+    QCommandLineOption traceOption("trace",
+                                   "Save a wire trace of the last session to file, see stm32replay.", "file");
+    QCommandLineOption stubOption("stub",
+                                  "Upload this RAM loader stub and program through it.", "file");
+    QCommandLineOption stubBaudrateOption("stub-baudrate",
+                                          "Baudrate the loader stub switches to.", "baudrate", "0");
+    QCommandLineOption stubAddressOption("stub-address",
+                                         "SRAM address the loader stub is uploaded to; 0 places it after the "
+                                         "RAM the ROM bootloader uses.", "address", "0");
+    parser.addOption(portOption);
+    parser.addOption(baudrateOption);
+    parser.addOption(imageOption);
+    parser.addOption(modeOption);
+    parser.addOption(verifyOption);
+    parser.addOption(massEraseOption);
+    parser.addOption(skipFlashedOption);
+    parser.addOption(readOption);
+    parser.addOption(addressOption);
+    parser.addOption(lengthOption);
+    parser.addOption(runOption);
+    parser.addOption(resumeOption);
+    parser.addOption(repeatOption);
+    parser.addOption(traceOption);
+    parser.addOption(stubOption);
+    parser.addOption(stubBaudrateOption);
+    parser.addOption(stubAddressOption);
+    parser.process(app);
+
+    QTextStream err(stderr);
+    const QString &port = parser.value(portOption);
+    const QString &image = parser.value(imageOption);
+    const QString &mode = parser.value(modeOption);
+    const QString &readout = parser.value(readOption);
+    if (port.isEmpty() || (image.isEmpty() && readout.isEmpty())) {
+        err << "--port and one of --image or --read are required" << Qt::endl;
+        return ExitUsage;
+    }
+    if (mode != "full" && mode != "differential") {
+        err << "Unknown mode: " << mode << Qt::endl;
+        return ExitUsage;
+    }
+
+    QList<qint32> baudrates;
+    foreach (const QString &rate, parser.value(baudrateOption).split(',', Qt::SkipEmptyParts)) {
+        qint32 baudrate = rate.toInt();
+        if (baudrate <= 0) {
+            err << "Invalid baudrate: " << rate << Qt::endl;
+            return ExitUsage;
+        }
+        baudrates << baudrate;
+    }
+    if (baudrates.isEmpty()) {
+        err << "No baudrate given" << Qt::endl;
+        return ExitUsage;
+    }
+
+    int repeat = parser.value(repeatOption).toInt();
+    if (repeat <= 0) {
+        err << "Invalid repeat count: " << parser.value(repeatOption) << Qt::endl;
+        return ExitUsage;
+    }
+
+    Bootloader bootloader;
+    bootloader.setPortName(port);
+    bootloader.setBaudrate(baudrates.first());
+    if (baudrates.size() > 1)
+        bootloader.setBaudrates(baudrates);
+    bootloader.setFilename(image);
+    bootloader.setDifferential(mode == "differential");
+    bootloader.setVerify(parser.isSet(verifyOption));
+    bootloader.setMassErase(parser.isSet(massEraseOption));
+    bootloader.setSkipFlashed(parser.isSet(skipFlashedOption));
+    bootloader.setReadoutFilename(readout);
+    bootloader.setReadoutAddress(parser.value(addressOption).toUInt(0, 0));
+    bootloader.setReadoutSize(parser.value(lengthOption).toUInt(0, 0));
+    bootloader.setRunApplication(parser.isSet(runOption));
+    bootloader.setResume(parser.isSet(resumeOption));
+    bootloader.setTraceFile(parser.value(traceOption));
+    bootloader.setStubFilename(parser.value(stubOption));
+    bootloader.setStubBaudrate(parser.value(stubBaudrateOption).toInt());
+    bootloader.setStubAddress(parser.value(stubAddressOption).toUInt(0, 0));
+
+    QTextStream out(stdout);
+    QList<double> totals;
+    QList<double> phaseSamples[Bootloader::PhaseCount];
+    int passed = 0;
+    int exitCode = ExitSuccess;
+
+    for (int run = 0; run < repeat; run++) {
+        bootloader.start();
+        bootloader.wait();
+
+        QJsonObject report = bootloader.report();
+        report.insert("mode", mode);
+        if (repeat > 1)
+            report.insert("run", run + 1);
+        out << QJsonDocument(report).toJson(QJsonDocument::Compact) << Qt::endl;
+
+        if (!bootloader.isSucceeded()) {
+            exitCode = ExitPhaseBase + bootloader.phase();
+            continue;
+        }
+
+        passed++;
+        totals << double(bootloader.elapsedMsecs());
+        for (int i = 0; i < Bootloader::PhaseCount; i++)
+            phaseSamples[i] << bootloader.phaseNsecs(Bootloader::Phase(i)) / 1000000.0;
+    }
+
+    if (repeat > 1) {
+        QJsonObject phases;
+        for (int i = 0; i < Bootloader::PhaseCount; i++)
+            phases.insert(Bootloader::phaseName(Bootloader::Phase(i)), distribution(phaseSamples[i]));
+
+        QJsonObject summary;
+        summary.insert("runs", repeat);
+        summary.insert("passed", passed);
+        summary.insert("elapsed_ms", distribution(totals));
+        summary.insert("phases_ms", phases);
+        out << QJsonDocument(summary).toJson(QJsonDocument::Compact) << Qt::endl;
+    }
+
+    return exitCode;
+}
@@ -20,14 +20,59 @@
  */
 
 #include <QDebug>
+#include <QScrollBar>
+#include <QTextCodec>
+#include <QTextDecoder>
 
 #include "consolescreen.h"
 
-ConsoleScreen::ConsoleScreen(QWidget *parent) : QPlainTextEdit(parent)
+ConsoleScreen::ConsoleScreen(QWidget *parent) :
+    QPlainTextEdit(parent),
+    decoder(QTextCodec::codecForName("UTF-8")->makeDecoder()),
+    maximumCharacters(0)
 {
 
 }
 
+ConsoleScreen::~ConsoleScreen()
+{
+    delete decoder;
+}
+
+/*
+ * Appends at the end of the document without touching the user's selection,
+ * and only follows the output while the view is scrolled to the bottom.
+ */
+void ConsoleScreen::appendData(const QByteArray &data)
+{
+    QScrollBar *scrollBar = verticalScrollBar();
+    bool follow = scrollBar->value() == scrollBar->maximum();
+
+    QTextCursor cursor(document());
+    cursor.movePosition(QTextCursor::End);
+    cursor.insertText(decoder->toUnicode(data));
+    trimScrollback();
+
+    if (follow)
+        scrollBar->setValue(scrollBar->maximum());
+}
+
+/*
+ * The block count limit caps lines; this caps very long lines too. Trim a
+ * quarter at a time so the cost is amortised over many appends.
+ */
+void ConsoleScreen::trimScrollback()
+{
+    QTextDocument *doc = document();
+    if (maximumCharacters <= 0 || doc->characterCount() <= maximumCharacters)
+        return;
+
+    QTextCursor cursor(doc);
+    cursor.movePosition(QTextCursor::Start);
+    cursor.setPosition(doc->characterCount() - maximumCharacters * 3 / 4, QTextCursor::KeepAnchor);
+    cursor.removeSelectedText();
+}
+
 void ConsoleScreen::keyPressEvent(QKeyEvent *event)
 {
     const QString &text = event->text();
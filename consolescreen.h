@@ -24,11 +24,21 @@
 
 #include <QPlainTextEdit>
 
+class QTextDecoder;
+
 class ConsoleScreen : public QPlainTextEdit
 {
     Q_OBJECT
 public:
     explicit ConsoleScreen(QWidget *parent = 0);
+    ~ConsoleScreen();
+
+    void appendData(const QByteArray &data);
+
+    void setMaximumCharacterCount(int maximum)
+    {
+        maximumCharacters = maximum;
+    }
 
 signals:
     void keyPress(int key);
@@ -37,6 +47,13 @@ public slots:
 
 protected:
     virtual void keyPressEvent(QKeyEvent *event);
+
+private:
+    void trimScrollback();
+
+private:
+    QTextDecoder *decoder;
+    int maximumCharacters;
 };
 
 #endif // CONSOLESCREEN_H
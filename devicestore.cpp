@@ -0,0 +1,133 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <QMutexLocker>
+#include <QRegExp>
+#include <QStringList>
+
+#include "qtcompat.h"
+#include "devicestore.h"
+
+DeviceStore::DeviceStore() :
+    settings("devices.ini", QSettings::IniFormat)
+{
+
+}
+
+DeviceStore *DeviceStore::instance()
+{
+    static DeviceStore store;
+    return &store;
+}
+
+QByteArray DeviceStore::imageHash(const QByteArray &uid)
+{
+    QMutexLocker locker(&mutex);
+    return QByteArray::fromHex(settings.value(key(uid) + "/Hash").toByteArray());
+}
+
+QDateTime DeviceStore::timestamp(const QByteArray &uid)
+{
+    QMutexLocker locker(&mutex);
+    return settings.value(key(uid) + "/Timestamp").toDateTime();
+}
+
+void DeviceStore::record(const QByteArray &uid, const QByteArray &hash)
+{
+    QMutexLocker locker(&mutex);
+    settings.setValue(key(uid) + "/Hash", hash.toHex());
+    settings.setValue(key(uid) + "/Timestamp", QDateTime::currentDateTime());
+    settings.sync();
+}
+
+void DeviceStore::remove(const QByteArray &uid)
+{
+    QMutexLocker locker(&mutex);
+    settings.remove(key(uid));
+    settings.sync();
+}
+
+QString DeviceStore::key(const QByteArray &uid)
+{
+    return QString::fromLatin1(uid.toHex());
+}
+
+bool DeviceStore::journal(const QString &port, const QByteArray &uid, FlashJournal &journal)
+{
+    QMutexLocker locker(&mutex);
+    QString group = journalKey(port, uid);
+    if (!settings.contains(group + "/Hash"))
+        return false;
+
+    journal.hash = QByteArray::fromHex(settings.value(group + "/Hash").toByteArray());
+    journal.sectors = splitInts(settings.value(group + "/Sectors").toString());
+    journal.erased = splitInts(settings.value(group + "/Erased").toString());
+    journal.confirmed = settings.value(group + "/Confirmed").toUInt();
+    journal.reserved = settings.value(group + "/Reserved").toUInt();
+    return true;
+}
+
+void DeviceStore::saveJournal(const QString &port, const QByteArray &uid, const FlashJournal &journal)
+{
+    QMutexLocker locker(&mutex);
+    QString group = journalKey(port, uid);
+    settings.setValue(group + "/Hash", journal.hash.toHex());
+    settings.setValue(group + "/Sectors", joinInts(journal.sectors));
+    settings.setValue(group + "/Erased", joinInts(journal.erased));
+    settings.setValue(group + "/Confirmed", journal.confirmed);
+    settings.setValue(group + "/Reserved", journal.reserved);
+    settings.setValue(group + "/Timestamp", QDateTime::currentDateTime());
+    settings.sync();
+}
+
+void DeviceStore::removeJournal(const QString &port, const QByteArray &uid)
+{
+    QMutexLocker locker(&mutex);
+    settings.remove(journalKey(port, uid));
+    settings.sync();
+}
+
+QString DeviceStore::journalKey(const QString &port, const QByteArray &uid)
+{
+    QString name = port;
+    name.replace(QRegExp("[^A-Za-z0-9]"), "_");
+    return QString("Journal_%1_%2").arg(key(uid), name);
+}
+
+/*
+ * Sector lists are stored space separated; QSettings would turn a comma
+ * separated value into a string list.
+ */
+QString DeviceStore::joinInts(const QList<int> &list)
+{
+    QStringList items;
+    foreach (int value, list)
+        items.append(QString::number(value));
+    return items.join(' ');
+}
+
+QList<int> DeviceStore::splitInts(const QString &text)
+{
+    QList<int> list;
+    foreach (const QString &item, text.split(' ', Qt::SkipEmptyParts))
+        list.append(item.toInt());
+    return list;
+}
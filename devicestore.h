@@ -0,0 +1,78 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef DEVICESTORE_H
+#define DEVICESTORE_H
+
+#include <QMutex>
+#include <QSettings>
+#include <QDateTime>
+#include <QList>
+
+/*
+ * Progress of an interrupted session: the sectors it set out to program,
+ * those already erased, the end of the last write the device confirmed and
+ * the bound writes may reach before the journal is saved again.
+ */
+struct FlashJournal
+{
+    FlashJournal() :
+        confirmed(0),
+        reserved(0)
+    {
+    }
+
+    QByteArray hash;
+    QList<int> sectors;
+    QList<int> erased;
+    quint32 confirmed;
+    quint32 reserved;
+};
+
+class DeviceStore
+{
+public:
+    static DeviceStore *instance();
+
+    QByteArray imageHash(const QByteArray &uid);
+    QDateTime timestamp(const QByteArray &uid);
+    void record(const QByteArray &uid, const QByteArray &hash);
+    void remove(const QByteArray &uid);
+
+    bool journal(const QString &port, const QByteArray &uid, FlashJournal &journal);
+    void saveJournal(const QString &port, const QByteArray &uid, const FlashJournal &journal);
+    void removeJournal(const QString &port, const QByteArray &uid);
+
+private:
+    DeviceStore();
+    Q_DISABLE_COPY(DeviceStore)
+
+    static QString key(const QByteArray &uid);
+    static QString journalKey(const QString &port, const QByteArray &uid);
+    static QString joinInts(const QList<int> &list);
+    static QList<int> splitInts(const QString &text);
+
+private:
+    QMutex mutex;
+    QSettings settings;
+};
+
+#endif // DEVICESTORE_H
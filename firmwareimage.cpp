@@ -0,0 +1,446 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+#include <QBitArray>
+
+#include "firmwareimage.h"
+
+static quint32 bigEndian(const QByteArray &data, int pos, int size)
+{
+    quint32 value = 0;
+    for (int i = 0; i < size; i++)
+        value = value << 8 | uchar(data.at(pos + i));
+    return value;
+}
+
+static quint32 littleEndian(const QByteArray &data, int pos, int size)
+{
+    quint32 value = 0;
+    for (int i = size - 1; i >= 0; i--)
+        value = value << 8 | uchar(data.at(pos + i));
+    return value;
+}
+
+struct Crc32Table
+{
+    Crc32Table()
+    {
+        for (quint32 i = 0; i < 256; i++) {
+            quint32 c = i;
+            for (int j = 0; j < 8; j++)
+                c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            entries[i] = c;
+        }
+    }
+
+    quint32 entries[256];
+};
+
+static bool segmentLessThan(const FirmwareImage::Segment &s1, const FirmwareImage::Segment &s2)
+{
+    return s1.address < s2.address;
+}
+
+FirmwareImage::FirmwareImage() :
+    entryPoint(0)
+{
+
+}
+
+bool FirmwareImage::load(const QString &filename, quint32 baseAddress, int alignment)
+{
+    clear();
+
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+        return setError(file.errorString());
+    const QByteArray data = file.readAll();
+    file.close();
+
+    return loadData(filename, data, baseAddress, alignment);
+}
+
+bool FirmwareImage::loadData(const QString &filename, const QByteArray &data, quint32 baseAddress, int alignment)
+{
+    clear();
+
+    bool ret = false;
+    switch (detectFormat(filename, data)) {
+    case BinaryFormat:
+        ret = loadBinary(data, baseAddress);
+        break;
+    case IntelHexFormat:
+        ret = loadIntelHex(data);
+        break;
+    case SRecordFormat:
+        ret = loadSRecord(data);
+        break;
+    case ElfFormat:
+        ret = loadElf(data);
+        break;
+    }
+
+    if (!ret)
+        return false;
+    if (isEmpty())
+        return setError("Image contains no data");
+
+    normalize(alignment);
+    return true;
+}
+
+bool FirmwareImage::loadBinary(const QByteArray &data, quint32 baseAddress)
+{
+    clear();
+    addData(baseAddress, data);
+    return true;
+}
+
+bool FirmwareImage::loadIntelHex(const QByteArray &data)
+{
+    clear();
+
+    quint32 base = 0;
+    int lineNo = 0;
+
+    foreach (const QByteArray &text, data.split('\n')) {
+        const QByteArray &line = text.trimmed();
+        lineNo++;
+        if (line.isEmpty())
+            continue;
+        if (line.at(0) != ':')
+            return setError(QString("Line %1: missing start code").arg(lineNo));
+
+        const QByteArray &record = QByteArray::fromHex(line.mid(1));
+        if (record.size() < 5 || record.size() * 2 != line.size() - 1
+                || record.size() != 5 + uchar(record.at(0)))
+            return setError(QString("Line %1: malformed record").arg(lineNo));
+
+        uchar sum = 0;
+        for (int i = 0; i < record.size(); i++)
+            sum += uchar(record.at(i));
+        if (sum != 0)
+            return setError(QString("Line %1: checksum mismatch").arg(lineNo));
+
+        int count = uchar(record.at(0));
+        quint32 offset = bigEndian(record, 1, 2);
+        int type = uchar(record.at(3));
+
+        switch (type) {
+        case 0x00:
+            addData(base + offset, record.mid(4, count));
+            break;
+        case 0x01:
+            return true;
+        case 0x02:
+            if (count != 2)
+                return setError(QString("Line %1: malformed segment address").arg(lineNo));
+            base = bigEndian(record, 4, 2) << 4;
+            break;
+        case 0x03:
+            if (count != 4)
+                return setError(QString("Line %1: malformed start address").arg(lineNo));
+            entryPoint = (bigEndian(record, 4, 2) << 4) + bigEndian(record, 6, 2);
+            break;
+        case 0x04:
+            if (count != 2)
+                return setError(QString("Line %1: malformed linear address").arg(lineNo));
+            base = bigEndian(record, 4, 2) << 16;
+            break;
+        case 0x05:
+            if (count != 4)
+                return setError(QString("Line %1: malformed start address").arg(lineNo));
+            entryPoint = bigEndian(record, 4, 4);
+            break;
+        default:
+            return setError(QString("Line %1: unknown record type %2").arg(lineNo).arg(type));
+        }
+    }
+
+    return true;
+}
+
+bool FirmwareImage::loadSRecord(const QByteArray &data)
+{
+    clear();
+
+    int lineNo = 0;
+
+    foreach (const QByteArray &text, data.split('\n')) {
+        const QByteArray &line = text.trimmed();
+        lineNo++;
+        if (line.isEmpty())
+            continue;
+        if (line.size() < 4 || line.at(0) != 'S')
+            return setError(QString("Line %1: missing start code").arg(lineNo));
+
+        const QByteArray &record = QByteArray::fromHex(line.mid(2));
+        if (record.size() < 3 || record.size() * 2 != line.size() - 2
+                || record.size() != 1 + uchar(record.at(0)))
+            return setError(QString("Line %1: malformed record").arg(lineNo));
+
+        uchar sum = 0;
+        for (int i = 0; i < record.size(); i++)
+            sum += uchar(record.at(i));
+        if (sum != 0xff)
+            return setError(QString("Line %1: checksum mismatch").arg(lineNo));
+
+        char type = line.at(1);
+        int addressSize;
+        switch (type) {
+        case '0': case '1': case '5': case '9':
+            addressSize = 2;
+            break;
+        case '2': case '6': case '8':
+            addressSize = 3;
+            break;
+        case '3': case '7':
+            addressSize = 4;
+            break;
+        default:
+            return setError(QString("Line %1: unknown record type S%2").arg(lineNo).arg(type));
+        }
+
+        int count = uchar(record.at(0));
+        if (count < addressSize + 1)
+            return setError(QString("Line %1: malformed record").arg(lineNo));
+        quint32 address = bigEndian(record, 1, addressSize);
+
+        switch (type) {
+        case '1': case '2': case '3':
+            addData(address, record.mid(1 + addressSize, count - addressSize - 1));
+            break;
+        case '7': case '8': case '9':
+            entryPoint = address;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool FirmwareImage::loadElf(const QByteArray &data)
+{
+    clear();
+
+    if (data.size() < 52 || !data.startsWith("\x7f" "ELF"))
+        return setError("Not an ELF file");
+    if (data.at(4) != 1)
+        return setError("Only 32-bit ELF files are supported");
+    if (data.at(5) != 1)
+        return setError("Only little-endian ELF files are supported");
+
+    entryPoint = littleEndian(data, 0x18, 4);
+    quint32 phoff = littleEndian(data, 0x1c, 4);
+    quint32 phentsize = littleEndian(data, 0x2a, 2);
+    quint32 phnum = littleEndian(data, 0x2c, 2);
+
+    for (quint32 i = 0; i < phnum; i++) {
+        qint64 end = qint64(phoff) + qint64(i) * phentsize + 32;
+        if (phentsize < 32 || end > data.size())
+            return setError("Truncated program header table");
+
+        int header = int(end - 32);
+        quint32 type = littleEndian(data, header, 4);
+        quint32 offset = littleEndian(data, header + 4, 4);
+        quint32 paddr = littleEndian(data, header + 12, 4);
+        quint32 filesz = littleEndian(data, header + 16, 4);
+
+        const quint32 PT_LOAD = 1;
+        if (type != PT_LOAD || filesz == 0)
+            continue;
+        if (qint64(offset) + filesz > data.size())
+            return setError("Truncated loadable segment");
+
+        addData(paddr, data.mid(int(offset), int(filesz)));
+    }
+
+    if (isEmpty())
+        return setError("No loadable segments");
+
+    return true;
+}
+
+/*
+ * Sort the segments, merge those that overlap or share an aligned block,
+ * and pad the start of every segment with 0xff down to the alignment.
+ * After this each block of the image belongs to exactly one segment and
+ * can be written with a single Write Memory frame; a short last block is
+ * padded when the frame is built. A segment that is already aligned keeps
+ * its data untouched, so a raw binary shares the buffer it was read into.
+ */
+void FirmwareImage::normalize(int alignment)
+{
+    std::sort(segmentList.begin(), segmentList.end(), segmentLessThan);
+
+    QList<Segment> merged;
+    quint32 mask = ~quint32(alignment - 1);
+
+    foreach (const Segment &segment, segmentList) {
+        quint32 start = segment.address & mask;
+        if (!merged.isEmpty() && start < ((merged.last().end() + alignment - 1) & mask)) {
+            Segment &last = merged.last();
+            int offset = segment.address - last.address;
+            int size = offset + segment.data.size();
+            if (size > last.data.size())
+                last.data.append(QByteArray(size - last.data.size(), 0xff));
+            last.data.replace(offset, segment.data.size(), segment.data);
+        } else if (start == segment.address) {
+            merged.append(segment);
+        } else {
+            Segment aligned;
+            aligned.address = start;
+            aligned.data = QByteArray(segment.address - start, 0xff) + segment.data;
+            merged.append(aligned);
+        }
+    }
+
+    segmentList = merged;
+}
+
+void FirmwareImage::clear()
+{
+    segmentList.clear();
+    entryPoint = 0;
+    error.clear();
+}
+
+FirmwareImage::Format FirmwareImage::detectFormat(const QString &filename, const QByteArray &data)
+{
+    const QString &suffix = QFileInfo(filename).suffix().toLower();
+
+    if (suffix == "bin")
+        return BinaryFormat;
+    if ((QStringList() << "hex" << "ihex" << "ihx").contains(suffix))
+        return IntelHexFormat;
+    if ((QStringList() << "s19" << "s28" << "s37" << "srec" << "mot").contains(suffix))
+        return SRecordFormat;
+    if ((QStringList() << "elf" << "axf" << "out").contains(suffix))
+        return ElfFormat;
+
+    if (data.startsWith("\x7f" "ELF"))
+        return ElfFormat;
+    const QByteArray &head = data.left(16).trimmed();
+    if (head.startsWith(':'))
+        return IntelHexFormat;
+    if (head.size() > 1 && head.at(0) == 'S' && head.at(1) >= '0' && head.at(1) <= '9')
+        return SRecordFormat;
+
+    return BinaryFormat;
+}
+
+/*
+ * Erased flash reads back as 0xff, so a block holding nothing else does not
+ * need to be written. Whole 64-bit words are AND-reduced per block, which
+ * the compiler turns into vector code, and only the odd tail is byte-wise.
+ */
+QBitArray FirmwareImage::blankBlocks(const QByteArray &data, int blockSize)
+{
+    const uchar *bytes = reinterpret_cast<const uchar *>(data.constData());
+    int size = data.size();
+    int count = (size + blockSize - 1) / blockSize;
+    QBitArray blank(count);
+
+    for (int i = 0; i < count; i++) {
+        const uchar *block = bytes + i * blockSize;
+        int length = qMin(blockSize, size - i * blockSize);
+        int words = length / sizeof(quint64);
+        quint64 acc = ~Q_UINT64_C(0);
+        for (int j = 0; j < words; j++) {
+            quint64 word;
+            memcpy(&word, block + j * sizeof(quint64), sizeof(word));
+            acc &= word;
+        }
+        uchar tail = 0xff;
+        for (int j = words * sizeof(quint64); j < length; j++)
+            tail &= block[j];
+        blank.setBit(i, acc == ~Q_UINT64_C(0) && tail == 0xff);
+    }
+
+    return blank;
+}
+
+quint32 FirmwareImage::crc32(const char *data, int size, quint32 crc)
+{
+    static const Crc32Table table;
+
+    crc = ~crc;
+    for (int i = 0; i < size; i++)
+        crc = table.entries[(crc ^ uchar(data[i])) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+int FirmwareImage::size() const
+{
+    int size = 0;
+    foreach (const Segment &segment, segmentList)
+        size += segment.data.size();
+    return size;
+}
+
+int FirmwareImage::segmentAt(quint32 address) const
+{
+    int low = 0;
+    int high = segmentList.size() - 1;
+
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        const Segment &segment = segmentList.at(mid);
+        if (address < segment.address)
+            high = mid - 1;
+        else if (address >= segment.end())
+            low = mid + 1;
+        else
+            return mid;
+    }
+
+    return -1;
+}
+
+void FirmwareImage::addData(quint32 address, const QByteArray &data)
+{
+    if (data.isEmpty())
+        return;
+
+    if (!segmentList.isEmpty() && segmentList.last().end() == address) {
+        segmentList.last().data.append(data);
+        return;
+    }
+
+    Segment segment;
+    segment.address = address;
+    segment.data = data;
+    segmentList.append(segment);
+}
+
+bool FirmwareImage::setError(const QString &message)
+{
+    segmentList.clear();
+    error = message;
+    return false;
+}
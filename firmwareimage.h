@@ -0,0 +1,112 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef FIRMWAREIMAGE_H
+#define FIRMWAREIMAGE_H
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+
+class QBitArray;
+
+class FirmwareImage
+{
+public:
+    struct Segment
+    {
+        quint32 address;
+        QByteArray data;
+
+        quint32 end() const
+        {
+            return address + data.size();
+        }
+    };
+
+    enum Format {
+        BinaryFormat,
+        IntelHexFormat,
+        SRecordFormat,
+        ElfFormat
+    };
+
+    static const quint32 DefaultBaseAddress = 0x08000000;
+
+    FirmwareImage();
+
+    bool load(const QString &filename, quint32 baseAddress = DefaultBaseAddress, int alignment = 256);
+    bool loadData(const QString &filename, const QByteArray &data, quint32 baseAddress = DefaultBaseAddress, int alignment = 256);
+    bool loadBinary(const QByteArray &data, quint32 baseAddress);
+    bool loadIntelHex(const QByteArray &data);
+    bool loadSRecord(const QByteArray &data);
+    bool loadElf(const QByteArray &data);
+    void normalize(int alignment);
+    void clear();
+
+    static Format detectFormat(const QString &filename, const QByteArray &data);
+    static QBitArray blankBlocks(const QByteArray &data, int blockSize);
+    static quint32 crc32(const char *data, int size, quint32 crc = 0);
+
+    bool isEmpty() const
+    {
+        return segmentList.isEmpty();
+    }
+
+    const QList<Segment> &segments() const
+    {
+        return segmentList;
+    }
+
+    quint32 lowestAddress() const
+    {
+        return segmentList.isEmpty() ? 0 : segmentList.first().address;
+    }
+
+    quint32 highestAddress() const
+    {
+        return segmentList.isEmpty() ? 0 : segmentList.last().end();
+    }
+
+    quint32 entry() const
+    {
+        return entryPoint;
+    }
+
+    int size() const;
+    int segmentAt(quint32 address) const;
+
+    QString errorString() const
+    {
+        return error;
+    }
+
+private:
+    void addData(quint32 address, const QByteArray &data);
+    bool setError(const QString &message);
+
+private:
+    QList<Segment> segmentList;
+    quint32 entryPoint;
+    QString error;
+};
+
+#endif // FIRMWAREIMAGE_H
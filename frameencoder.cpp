@@ -0,0 +1,74 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <string.h>
+
+#include "frameencoder.h"
+
+/*
+ * A byte and its complement; used for commands and for the Read Memory
+ * byte count.
+ */
+void FrameEncoder::command(quint8 cmd)
+{
+    Q_ASSERT(length + 2 <= Capacity);
+    buffer[length++] = char(cmd);
+    buffer[length++] = char(cmd ^ 0xff);
+}
+
+/*
+ * Big endian address followed by the XOR of its bytes.
+ */
+void FrameEncoder::address(quint32 addr)
+{
+    Q_ASSERT(length + 5 <= Capacity);
+    char *out = buffer + length;
+    out[0] = char(addr >> 24);
+    out[1] = char(addr >> 16);
+    out[2] = char(addr >> 8);
+    out[3] = char(addr);
+    out[4] = out[0] ^ out[1] ^ out[2] ^ out[3];
+    length += 5;
+}
+
+void FrameEncoder::data(const char *data, int size, int frameSize)
+{
+    Q_ASSERT(length + frameSize + 2 <= Capacity);
+    length += encodeData(buffer + length, data, size, frameSize);
+}
+
+/*
+ * Write Memory data frame: byte count minus one, the data padded with 0xff
+ * to frameSize, and the XOR of everything before it. out must hold
+ * frameSize + 2 bytes; returns that length.
+ */
+int FrameEncoder::encodeData(char *out, const char *data, int size, int frameSize)
+{
+    out[0] = char(frameSize - 1);
+    memcpy(out + 1, data, size);
+    memset(out + 1 + size, 0xff, frameSize - size);
+
+    char sum = 0;
+    for (int i = 0; i <= frameSize; i++)
+        sum ^= out[i];
+    out[frameSize + 1] = sum;
+    return frameSize + 2;
+}
@@ -0,0 +1,72 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef FRAMEENCODER_H
+#define FRAMEENCODER_H
+
+#include <QtGlobal>
+
+/*
+ * Fixed buffer the session encodes AN3155 frames into, reused for every
+ * command so the hot path never allocates. Frames are appended; clear()
+ * starts the next one.
+ */
+class FrameEncoder
+{
+public:
+    enum {
+        MaxData = 256,
+        Capacity = MaxData + 8
+    };
+
+    FrameEncoder() :
+        length(0)
+    {
+
+    }
+
+    void clear()
+    {
+        length = 0;
+    }
+
+    const char *constData() const
+    {
+        return buffer;
+    }
+
+    int size() const
+    {
+        return length;
+    }
+
+    void command(quint8 cmd);
+    void address(quint32 addr);
+    void data(const char *data, int size, int frameSize);
+
+    static int encodeData(char *out, const char *data, int size, int frameSize);
+
+private:
+    char buffer[Capacity];
+    int length;
+};
+
+#endif // FRAMEENCODER_H
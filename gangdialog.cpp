@@ -0,0 +1,215 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <QDebug>
+#include <QLabel>
+#include <QPushButton>
+#include <QProgressBar>
+#include <QTableWidget>
+#include <QHeaderView>
+#include <QVBoxLayout>
+#include <QHBoxLayout>
+#include <QSerialPortInfo>
+
+#include "settings.h"
+#include "bootloader.h"
+#include "gangdialog.h"
+
+enum GangColumn {
+    PortColumn,
+    ProgressColumn,
+    ResultColumn,
+    TimeColumn,
+    ColumnCount
+};
+
+GangDialog::GangDialog(const Bootloader *prototype, const QString &filename, bool autoBaudrate, QWidget *parent) :
+    QDialog(parent),
+    prototype(prototype),
+    filename(filename),
+    autoBaudrate(autoBaudrate),
+    table(new QTableWidget(this)),
+    startPushButton(new QPushButton(tr("Start"), this)),
+    closePushButton(new QPushButton(tr("Close"), this)),
+    summaryLabel(new QLabel(this)),
+    running(0),
+    started(0),
+    passed(0)
+{
+    setWindowTitle(tr("Gang Programming"));
+    resize(640, 480);
+
+    table->setColumnCount(ColumnCount);
+    table->setHorizontalHeaderLabels(QStringList() << tr("Port") << tr("Progress") << tr("Result") << tr("Time (ms)"));
+    table->horizontalHeader()->setStretchLastSection(true);
+    table->verticalHeader()->setVisible(false);
+    table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+
+    const QStringList &selected = Settings::instance()->value("GangPorts").toStringList();
+    QListIterator<QSerialPortInfo> portinfos(QSerialPortInfo::availablePorts());
+    while (portinfos.hasNext()) {
+        const QString &port = portinfos.next().portName();
+        int row = table->rowCount();
+        table->insertRow(row);
+
+        QTableWidgetItem *item = new QTableWidgetItem(port);
+        item->setFlags(Qt::ItemIsEnabled | Qt::ItemIsUserCheckable);
+        item->setCheckState(selected.contains(port) ? Qt::Checked : Qt::Unchecked);
+        table->setItem(row, PortColumn, item);
+        table->setCellWidget(row, ProgressColumn, new QProgressBar(table));
+        table->setItem(row, ResultColumn, new QTableWidgetItem);
+        table->setItem(row, TimeColumn, new QTableWidgetItem);
+
+        Bootloader *bootloader = new Bootloader;
+        connect(bootloader, SIGNAL(progressValue(int)), this, SLOT(loadProgress(int)));
+        connect(bootloader, SIGNAL(baudrateNegotiated(qint32)), this, SLOT(loadBaudrate(qint32)));
+        connect(bootloader, SIGNAL(completed(bool,qint64)), this, SLOT(loadCompleted(bool,qint64)));
+        bootloaders.append(bootloader);
+    }
+
+    QHBoxLayout *buttonLayout = new QHBoxLayout;
+    buttonLayout->addWidget(summaryLabel);
+    buttonLayout->addStretch();
+    buttonLayout->addWidget(startPushButton);
+    buttonLayout->addWidget(closePushButton);
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->addWidget(table);
+    layout->addLayout(buttonLayout);
+
+    connect(startPushButton, SIGNAL(pressed()), this, SLOT(startAction()));
+    connect(closePushButton, SIGNAL(pressed()), this, SLOT(reject()));
+}
+
+GangDialog::~GangDialog()
+{
+    foreach (Bootloader *bootloader, bootloaders)
+        bootloader->wait();
+    qDeleteAll(bootloaders);
+}
+
+/*
+ * The image is loaded once through the cache; every Bootloader gets a
+ * handle to the same immutable entry.
+ */
+void GangDialog::startAction()
+{
+    QString error;
+    const ImageHandle &image = ImageCache::instance()->load(filename, &error);
+    if (!image) {
+        summaryLabel->setText(tr("Cannot load %1: %2").arg(filename).arg(error));
+        return;
+    }
+
+    QStringList ports;
+    running = 0;
+    passed = 0;
+
+    for (int row = 0; row < table->rowCount(); row++) {
+        if (table->item(row, PortColumn)->checkState() != Qt::Checked)
+            continue;
+
+        const QString &port = table->item(row, PortColumn)->text();
+        Bootloader *bootloader = bootloaders.at(row);
+        bootloader->wait();
+        bootloader->setOptions(prototype);
+        bootloader->setPortName(port);
+        bootloader->setImage(image);
+        if (autoBaudrate)
+            bootloader->setBaudrates(Settings::instance()->autoBaudrates(port));
+
+        int minimum, maximum;
+        bootloader->progressRange(minimum, maximum);
+        progressBar(row)->setRange(minimum, maximum);
+        progressBar(row)->setValue(minimum);
+        table->item(row, ResultColumn)->setText(tr("Running"));
+        table->item(row, TimeColumn)->setText(QString());
+
+        ports.append(port);
+        running++;
+        bootloader->start();
+    }
+
+    Settings::instance()->setValue("GangPorts", ports);
+    started = running;
+
+    if (running > 0) {
+        timer.start();
+        startPushButton->setDisabled(true);
+        closePushButton->setDisabled(true);
+        summaryLabel->setText(tr("Programming %1 ports").arg(running));
+    }
+}
+
+void GangDialog::loadProgress(int value)
+{
+    int row = rowOf(sender());
+    if (row >= 0)
+        progressBar(row)->setValue(value);
+}
+
+void GangDialog::loadBaudrate(qint32 baudrate)
+{
+    int row = rowOf(sender());
+    if (row >= 0)
+        Settings::instance()->setAdapterBaudrate(table->item(row, PortColumn)->text(), baudrate);
+}
+
+void GangDialog::loadCompleted(bool success, qint64 msecs)
+{
+    int row = rowOf(sender());
+    if (row < 0)
+        return;
+
+    table->item(row, ResultColumn)->setText(success ? tr("Passed") : tr("Failed"));
+    table->item(row, TimeColumn)->setText(QString::number(msecs));
+    if (success) {
+        passed++;
+        Settings::instance()->countAdapterSession(table->item(row, PortColumn)->text());
+    }
+
+    if (--running == 0) {
+        startPushButton->setEnabled(true);
+        closePushButton->setEnabled(true);
+        summaryLabel->setText(tr("%1 passed, %2 failed in %3 ms")
+                              .arg(passed)
+                              .arg(started - passed)
+                              .arg(timer.elapsed()));
+    }
+}
+
+void GangDialog::reject()
+{
+    if (running > 0)
+        return;
+
+    QDialog::reject();
+}
+
+int GangDialog::rowOf(QObject *object) const
+{
+    return bootloaders.indexOf(qobject_cast<Bootloader *>(object));
+}
+
+QProgressBar *GangDialog::progressBar(int row) const
+{
+    return qobject_cast<QProgressBar *>(table->cellWidget(row, ProgressColumn));
+}
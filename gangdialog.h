@@ -0,0 +1,70 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef GANGDIALOG_H
+#define GANGDIALOG_H
+
+#include <QDialog>
+#include <QElapsedTimer>
+
+class QTableWidget;
+class QPushButton;
+class QLabel;
+class QProgressBar;
+class Bootloader;
+
+class GangDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit GangDialog(const Bootloader *prototype, const QString &filename, bool autoBaudrate, QWidget *parent = 0);
+    ~GangDialog();
+
+public Q_SLOTS:
+    void startAction();
+    void loadProgress(int value);
+    void loadBaudrate(qint32 baudrate);
+    void loadCompleted(bool success, qint64 msecs);
+
+protected:
+    virtual void reject();
+
+private:
+    int rowOf(QObject *object) const;
+    QProgressBar *progressBar(int row) const;
+
+private:
+    const Bootloader *prototype;
+    QString filename;
+    bool autoBaudrate;
+    QTableWidget *table;
+    QPushButton *startPushButton;
+    QPushButton *closePushButton;
+    QLabel *summaryLabel;
+    QList<Bootloader *> bootloaders;
+    QElapsedTimer timer;
+    int running;
+    int started;
+    int passed;
+};
+
+#endif // GANGDIALOG_H
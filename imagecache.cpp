@@ -0,0 +1,124 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <QDebug>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QCryptographicHash>
+
+#include "imagecache.h"
+
+ImageCache *ImageCache::instance()
+{
+    static ImageCache cache;
+    return &cache;
+}
+
+/*
+ * Entries are keyed by canonical path, modification time and size, and
+ * shared between keys whose contents hash the same. The file is read
+ * into memory once and a raw binary's segment shares that buffer, so a
+ * build rewriting the file in place cannot change bytes under a running
+ * job or its hash and checksums; handles keep an entry alive after it is
+ * evicted.
+ */
+ImageHandle ImageCache::load(const QString &filename, QString *errorString)
+{
+    QFileInfo info(filename);
+    if (!info.exists()) {
+        if (errorString)
+            *errorString = QString("%1 does not exist").arg(filename);
+        return ImageHandle();
+    }
+
+    const QString &path = info.canonicalFilePath();
+    const QString &key = QString("%1|%2|%3")
+            .arg(path)
+            .arg(info.lastModified().toMSecsSinceEpoch())
+            .arg(info.size());
+
+    QMutexLocker locker(&mutex);
+
+    if (entries.contains(key)) {
+        order.removeAll(key);
+        order.append(key);
+        return entries.value(key);
+    }
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (errorString)
+            *errorString = file.errorString();
+        return ImageHandle();
+    }
+
+    QSharedPointer<CachedImage> entry(new CachedImage);
+    const QByteArray &data = file.readAll();
+    file.close();
+
+    if (!entry->firmware.loadData(path, data)) {
+        if (errorString)
+            *errorString = entry->firmware.errorString();
+        return ImageHandle();
+    }
+
+    entry->sha1 = QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+
+    QHashIterator<QString, QSharedPointer<CachedImage> > it(entries);
+    while (it.hasNext()) {
+        it.next();
+        if (it.value()->sha1 == entry->sha1) {
+            entry = it.value();
+            break;
+        }
+    }
+
+    if (entry->blanks.isEmpty()) {
+        const QList<FirmwareImage::Segment> &segments = entry->firmware.segments();
+        for (int s = 0; s < segments.size(); s++) {
+            const QByteArray &segment = segments.at(s).data;
+            QVector<quint32> checksum((segment.size() + BlockSize - 1) / BlockSize);
+            for (int i = 0; i < checksum.size(); i++) {
+                int bytes = qMin(BlockSize, segment.size() - i * BlockSize);
+                checksum[i] = FirmwareImage::crc32(segment.constData() + i * BlockSize, bytes);
+            }
+            entry->blanks.append(FirmwareImage::blankBlocks(segment, BlockSize));
+            entry->checksums.append(checksum);
+        }
+    }
+
+    entries.insert(key, entry);
+    order.append(key);
+    while (order.size() > MaxEntries)
+        entries.remove(order.takeFirst());
+
+    qDebug() << "Image cached:" << path << entry->sha1.toHex();
+    return entry;
+}
+
+void ImageCache::clear()
+{
+    QMutexLocker locker(&mutex);
+    entries.clear();
+    order.clear();
+}
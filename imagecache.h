@@ -0,0 +1,93 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef IMAGECACHE_H
+#define IMAGECACHE_H
+
+#include <QHash>
+#include <QMutex>
+#include <QVector>
+#include <QBitArray>
+#include <QStringList>
+#include <QSharedPointer>
+
+#include "firmwareimage.h"
+
+class CachedImage
+{
+public:
+    static const int BlockSize = 256;
+
+    const FirmwareImage &image() const
+    {
+        return firmware;
+    }
+
+    QByteArray hash() const
+    {
+        return sha1;
+    }
+
+    const QBitArray &blankBlocks(int segment) const
+    {
+        return blanks.at(segment);
+    }
+
+    quint32 blockChecksum(int segment, int block) const
+    {
+        return checksums.at(segment).at(block);
+    }
+
+private:
+    friend class ImageCache;
+    CachedImage() {}
+    Q_DISABLE_COPY(CachedImage)
+
+private:
+    FirmwareImage firmware;
+    QByteArray sha1;
+    QList<QBitArray> blanks;
+    QList<QVector<quint32> > checksums;
+};
+
+typedef QSharedPointer<const CachedImage> ImageHandle;
+
+class ImageCache
+{
+public:
+    static ImageCache *instance();
+
+    ImageHandle load(const QString &filename, QString *errorString = 0);
+    void clear();
+
+private:
+    ImageCache() {}
+    Q_DISABLE_COPY(ImageCache)
+
+private:
+    static const int MaxEntries = 8;
+
+    QMutex mutex;
+    QHash<QString, QSharedPointer<CachedImage> > entries;
+    QStringList order;
+};
+
+#endif // IMAGECACHE_H
@@ -0,0 +1,86 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <QElapsedTimer>
+
+#include "imagepreparer.h"
+
+ImagePreparer::ImagePreparer(QObject *parent) :
+    QThread(parent),
+    nsecs(0)
+{
+
+}
+
+ImagePreparer::~ImagePreparer()
+{
+    wait();
+}
+
+/*
+ * A handle already loaded by the caller is kept and only its blocks are
+ * planned; otherwise the file goes through the image cache.
+ */
+void ImagePreparer::prepare(const QString &filename, const ImageHandle &image)
+{
+    wait();
+    this->filename = filename;
+    cached = image;
+    error.clear();
+    plan.clear();
+    nsecs = 0;
+    start();
+}
+
+void ImagePreparer::run()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    if (!cached) {
+        cached = ImageCache::instance()->load(filename, &error);
+        if (!cached)
+            return;
+    }
+
+    const int blockSize = CachedImage::BlockSize;
+    const QList<FirmwareImage::Segment> &segments = cached->image().segments();
+    int count = 0;
+    for (int s = 0; s < segments.size(); s++)
+        count += cached->blankBlocks(s).count(false);
+    plan.reserve(count);
+
+    for (int s = 0; s < segments.size(); s++) {
+        const QByteArray &bin = segments.at(s).data;
+        const QBitArray &blank = cached->blankBlocks(s);
+        for (int i = 0; i < blank.size(); i++) {
+            if (blank.testBit(i))
+                continue;
+            Block block;
+            block.address = segments.at(s).address + i * blockSize;
+            block.size = qMin(blockSize, bin.size() - i * blockSize);
+            block.data = bin.constData() + i * blockSize;
+            plan.append(block);
+        }
+    }
+
+    nsecs = timer.nsecsElapsed();
+}
@@ -0,0 +1,85 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef IMAGEPREPARER_H
+#define IMAGEPREPARER_H
+
+#include <QThread>
+#include <QVector>
+
+#include "imagecache.h"
+
+/*
+ * Loads the image and plans its non-blank write blocks on a thread of its
+ * own, started before boot entry so the host work overlaps the reset delay
+ * and the handshake. Blocks point into the shared cached image and are
+ * encoded only as they are written. Results are valid once wait() has
+ * returned.
+ */
+class ImagePreparer : public QThread
+{
+    Q_OBJECT
+
+public:
+    struct Block
+    {
+        quint32 address;
+        int size;
+        const char *data;
+    };
+
+    explicit ImagePreparer(QObject *parent = 0);
+    ~ImagePreparer();
+
+    void prepare(const QString &filename, const ImageHandle &image);
+
+    ImageHandle image() const
+    {
+        return cached;
+    }
+
+    QString errorString() const
+    {
+        return error;
+    }
+
+    const QVector<Block> &blocks() const
+    {
+        return plan;
+    }
+
+    qint64 elapsedNsecs() const
+    {
+        return nsecs;
+    }
+
+protected:
+    virtual void run();
+
+private:
+    QString filename;
+    ImageHandle cached;
+    QString error;
+    QVector<Block> plan;
+    qint64 nsecs;
+};
+
+#endif // IMAGEPREPARER_H
@@ -0,0 +1,108 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <QFileInfo>
+
+#include "imagewriter.h"
+
+const int HexRecordBytes = 16;
+const quint8 DataRecord = 0x00;
+const quint8 EndOfFileRecord = 0x01;
+const quint8 ExtendedLinearAddressRecord = 0x04;
+
+ImageWriter::ImageWriter() :
+    hex(false),
+    upper(0xffffffff)
+{
+    line.reserve(2 * HexRecordBytes + 16);
+}
+
+bool ImageWriter::isHexFile(const QString &filename)
+{
+    const QString &suffix = QFileInfo(filename).suffix().toLower();
+    return suffix == "hex" || suffix == "ihex";
+}
+
+bool ImageWriter::open(const QString &filename)
+{
+    file.setFileName(filename);
+    hex = isHexFile(filename);
+    upper = 0xffffffff;
+    return file.open(QIODevice::WriteOnly | QIODevice::Truncate);
+}
+
+bool ImageWriter::write(quint32 address, const QByteArray &data)
+{
+    if (!hex)
+        return file.write(data) == data.size();
+
+    int pos = 0;
+    while (pos < data.size()) {
+        quint32 addr = address + pos;
+        if (addr >> 16 != upper) {
+            upper = addr >> 16;
+            const char segment[2] = { char(upper >> 8), char(upper) };
+            appendRecord(ExtendedLinearAddressRecord, 0, segment, sizeof(segment));
+        }
+
+        // records never straddle a 64 KB boundary
+        int size = qMin(data.size() - pos, HexRecordBytes);
+        size = int(qMin(quint32(size), 0x10000 - (addr & 0xffff)));
+        appendRecord(DataRecord, quint16(addr), data.constData() + pos, size);
+        pos += size;
+    }
+
+    return file.error() == QFile::NoError;
+}
+
+bool ImageWriter::close()
+{
+    if (hex)
+        appendRecord(EndOfFileRecord, 0, 0, 0);
+    bool ok = file.flush() && file.error() == QFile::NoError;
+    file.close();
+    return ok;
+}
+
+void ImageWriter::appendRecord(quint8 type, quint16 address, const char *data, int size)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    quint8 sum = quint8(size) + quint8(address >> 8) + quint8(address) + type;
+
+    line.resize(0);
+    line.append(':');
+    const quint8 header[4] = { quint8(size), quint8(address >> 8), quint8(address), type };
+    for (int i = 0; i < 4; i++) {
+        line.append(digits[header[i] >> 4]);
+        line.append(digits[header[i] & 0x0f]);
+    }
+    for (int i = 0; i < size; i++) {
+        quint8 byte = quint8(data[i]);
+        sum += byte;
+        line.append(digits[byte >> 4]);
+        line.append(digits[byte & 0x0f]);
+    }
+    sum = quint8(-sum);
+    line.append(digits[sum >> 4]);
+    line.append(digits[sum & 0x0f]);
+    line.append('\n');
+    file.write(line);
+}
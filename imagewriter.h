@@ -0,0 +1,57 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include <QFile>
+
+/*
+ * Streams memory read from a device to a raw binary or Intel HEX file, chosen
+ * by extension, one block at a time. Blocks must arrive in address order.
+ */
+class ImageWriter
+{
+public:
+    ImageWriter();
+
+    bool open(const QString &filename);
+    bool write(quint32 address, const QByteArray &data);
+    bool close();
+
+    QString errorString() const
+    {
+        return file.errorString();
+    }
+
+    static bool isHexFile(const QString &filename);
+
+private:
+    void appendRecord(quint8 type, quint16 address, const char *data, int size);
+
+private:
+    QFile file;
+    bool hex;
+    quint32 upper;
+    QByteArray line;
+};
+
+#endif // IMAGEWRITER_H
@@ -0,0 +1,193 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <cstring>
+#include <algorithm>
+
+#include "lineindex.h"
+
+LineMatcher::LineMatcher() :
+    regex(false),
+    caseSensitive(true)
+{
+
+}
+
+LineMatcher::LineMatcher(const QString &pattern, bool regex, bool caseSensitive) :
+    pattern(pattern),
+    regex(regex),
+    caseSensitive(caseSensitive)
+{
+    if (regex)
+        expression = QRegularExpression(pattern, caseSensitive ? QRegularExpression::NoPatternOption
+                                                               : QRegularExpression::CaseInsensitiveOption);
+    else
+        matcher.setPattern(pattern.toUtf8());
+}
+
+bool LineMatcher::matches(const char *data, int size) const
+{
+    if (pattern.isEmpty())
+        return true;
+    if (isPlain())
+        return matcher.indexIn(data, size) >= 0;
+    if (!regex)
+        return QString::fromUtf8(data, size).contains(pattern, Qt::CaseInsensitive);
+    return expression.match(QString::fromUtf8(data, size)).hasMatch();
+}
+
+/*
+ * True when every line this matches is also matched by other, so a filter
+ * being typed can re-test the previous hits instead of the whole log.
+ */
+bool LineMatcher::narrows(const LineMatcher &other) const
+{
+    if (regex || other.regex || caseSensitive != other.caseSensitive)
+        return false;
+    return pattern.contains(other.pattern, caseSensitive ? Qt::CaseSensitive : Qt::CaseInsensitive);
+}
+
+LineIndex::LineIndex(int maximumBytes) :
+    first(0),
+    partial(false),
+    maximumBytes(maximumBytes)
+{
+
+}
+
+void LineIndex::clear()
+{
+    first = lineCount();
+    data.resize(0);
+    starts.resize(0);
+    partial = false;
+}
+
+void LineIndex::append(const QByteArray &bytes)
+{
+    if (bytes.isEmpty())
+        return;
+
+    int base = data.size();
+    if (!partial) {
+        starts.append(base);
+        partial = true;
+    }
+    data.append(bytes);
+
+    const char *begin = data.constData();
+    const char *end = begin + data.size();
+    const char *newline = static_cast<const char *>(memchr(begin + base, '\n', end - begin - base));
+    while (newline) {
+        if (newline + 1 < end) {
+            starts.append(int(newline + 1 - begin));
+        } else {
+            partial = false;
+            break;
+        }
+        newline = static_cast<const char *>(memchr(newline + 1, '\n', end - newline - 1));
+    }
+
+    if (data.size() <= maximumBytes)
+        return;
+
+    // drop whole lines down to three quarters of the budget
+    int target = data.size() - maximumBytes * 3 / 4;
+    int count = int(std::lower_bound(starts.constBegin(), starts.constEnd(), target) - starts.constBegin());
+    if (count >= starts.size()) {
+        clear();
+        return;
+    }
+
+    int offset = starts.at(count);
+    data.remove(0, offset);
+    starts.remove(0, count);
+    for (int i = 0; i < starts.size(); i++)
+        starts[i] -= offset;
+    first += count;
+}
+
+int LineIndex::lineEnd(int index) const
+{
+    int end;
+    if (index + 1 < starts.size())
+        end = starts.at(index + 1) - 1;
+    else
+        end = partial ? data.size() : data.size() - 1;
+
+    if (end > starts.at(index) && data.at(end - 1) == '\r')
+        end--;
+    return end;
+}
+
+QByteArray LineIndex::line(qint64 number) const
+{
+    if (number < first || number >= lineCount())
+        return QByteArray();
+
+    int index = int(number - first);
+    return data.mid(starts.at(index), lineEnd(index) - starts.at(index));
+}
+
+void LineIndex::collect(const LineMatcher &matcher, qint64 from, qint64 to, QVector<qint64> &lines, int limit) const
+{
+    int begin = int(qMax(from, first) - first);
+    int end = int(qMin(to, lineCount()) - first);
+    if (begin >= end || limit == 0)
+        return;
+
+    if (!matcher.isPlain() || matcher.isEmpty()) {
+        for (int i = begin; i < end; i++) {
+            if (matcher.matches(data.constData() + starts.at(i), lineEnd(i) - starts.at(i))) {
+                lines.append(first + i);
+                if (--limit == 0)
+                    return;
+            }
+        }
+        return;
+    }
+
+    // search the raw bytes and map each hit back to its line
+    int pos = starts.at(begin);
+    int stop = end < starts.size() ? starts.at(end) : data.size();
+    forever {
+        int hit = matcher.bytes().indexIn(data.constData(), stop, pos);
+        if (hit < 0)
+            return;
+
+        int index = int(std::upper_bound(starts.constBegin() + begin, starts.constBegin() + end, hit)
+                        - starts.constBegin()) - 1;
+        lines.append(first + index);
+        if (--limit == 0 || index + 1 >= end)
+            return;
+        pos = starts.at(index + 1);
+    }
+}
+
+qint64 LineIndex::findPrevious(const LineMatcher &matcher, qint64 from) const
+{
+    for (qint64 number = qMin(from, lineCount() - 1); number >= first; number--) {
+        int index = int(number - first);
+        if (matcher.matches(data.constData() + starts.at(index), lineEnd(index) - starts.at(index)))
+            return number;
+    }
+    return -1;
+}
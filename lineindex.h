@@ -0,0 +1,113 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef LINEINDEX_H
+#define LINEINDEX_H
+
+#include <QByteArray>
+#include <QByteArrayMatcher>
+#include <QRegularExpression>
+#include <QString>
+#include <QVector>
+
+class LineMatcher
+{
+public:
+    LineMatcher();
+    LineMatcher(const QString &pattern, bool regex, bool caseSensitive);
+
+    bool isEmpty() const
+    {
+        return pattern.isEmpty();
+    }
+
+    bool isValid() const
+    {
+        return !regex || expression.isValid();
+    }
+
+    // plain case sensitive substrings can be searched on the raw bytes
+    bool isPlain() const
+    {
+        return !regex && caseSensitive;
+    }
+
+    const QByteArrayMatcher &bytes() const
+    {
+        return matcher;
+    }
+
+    bool matches(const char *data, int size) const;
+    bool narrows(const LineMatcher &other) const;
+
+private:
+    QString pattern;
+    bool regex;
+    bool caseSensitive;
+    QByteArrayMatcher matcher;
+    QRegularExpression expression;
+};
+
+/*
+ * Append-only store of console text with the offset of every line, built as
+ * data arrives. Line numbers are absolute; once the byte budget is exceeded
+ * the oldest lines are dropped and firstLine() moves on.
+ */
+class LineIndex
+{
+public:
+    explicit LineIndex(int maximumBytes = 64 * 1024 * 1024);
+
+    void clear();
+    void append(const QByteArray &data);
+
+    qint64 firstLine() const
+    {
+        return first;
+    }
+
+    qint64 lineCount() const
+    {
+        return first + starts.size();
+    }
+
+    // lines terminated by a newline; the last line may still be growing
+    qint64 completeLines() const
+    {
+        return lineCount() - (partial ? 1 : 0);
+    }
+
+    QByteArray line(qint64 number) const;
+    void collect(const LineMatcher &matcher, qint64 from, qint64 to, QVector<qint64> &lines, int limit = -1) const;
+    qint64 findPrevious(const LineMatcher &matcher, qint64 from) const;
+
+private:
+    int lineEnd(int index) const;
+
+private:
+    QByteArray data;
+    QVector<int> starts;
+    qint64 first;
+    bool partial;
+    int maximumBytes;
+};
+
+#endif // LINEINDEX_H
@@ -0,0 +1,152 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <cstring>
+#include <QVector>
+
+#include "lz4block.h"
+
+const int MinMatch = 4;
+const int LastLiterals = 5;
+const int MatchLimit = 12;
+const int MaxOffset = 65535;
+const int HashBits = 12;
+
+static inline int hash(const char *p)
+{
+    quint32 sequence;
+    memcpy(&sequence, p, sizeof(sequence));
+    return int((sequence * 2654435761u) >> (32 - HashBits));
+}
+
+void Lz4Block::appendLength(QByteArray &out, int length)
+{
+    while (length >= 255) {
+        out.append(char(255));
+        length -= 255;
+    }
+    out.append(char(length));
+}
+
+QByteArray Lz4Block::compress(const char *data, int size)
+{
+    QByteArray out;
+    out.reserve(size + size / 255 + 16);
+    QVector<int> table(1 << HashBits, -1);
+
+    int anchor = 0;
+    int pos = 0;
+    int limit = size - MatchLimit;
+
+    while (pos < limit) {
+        int h = hash(data + pos);
+        int ref = table.at(h);
+        table[h] = pos;
+        if (ref < 0 || pos - ref > MaxOffset || memcmp(data + ref, data + pos, MinMatch) != 0) {
+            pos++;
+            continue;
+        }
+
+        // the last match has to end LastLiterals bytes before the end
+        int length = MinMatch;
+        int maximum = size - LastLiterals - pos;
+        while (length < maximum && data[ref + length] == data[pos + length])
+            length++;
+
+        int literals = pos - anchor;
+        int matchCode = length - MinMatch;
+        out.append(char((qMin(literals, 15) << 4) | qMin(matchCode, 15)));
+        if (literals >= 15)
+            appendLength(out, literals - 15);
+        out.append(data + anchor, literals);
+        out.append(char((pos - ref) & 0xff));
+        out.append(char((pos - ref) >> 8));
+        if (matchCode >= 15)
+            appendLength(out, matchCode - 15);
+
+        pos += length;
+        anchor = pos;
+    }
+
+    int literals = size - anchor;
+    out.append(char(qMin(literals, 15) << 4));
+    if (literals >= 15)
+        appendLength(out, literals - 15);
+    out.append(data + anchor, literals);
+    return out;
+}
+
+bool Lz4Block::decompress(const char *src, int srcSize, char *dst, int dstSize)
+{
+    const uchar *in = reinterpret_cast<const uchar *>(src);
+    int ip = 0;
+    int op = 0;
+
+    while (ip < srcSize) {
+        uchar token = in[ip++];
+
+        int literals = token >> 4;
+        if (literals == 15) {
+            uchar byte;
+            do {
+                if (ip >= srcSize)
+                    return false;
+                byte = in[ip++];
+                literals += byte;
+            } while (byte == 255);
+        }
+        if (literals > srcSize - ip || literals > dstSize - op)
+            return false;
+        memcpy(dst + op, src + ip, literals);
+        ip += literals;
+        op += literals;
+
+        if (ip == srcSize)
+            break;
+
+        if (srcSize - ip < 2)
+            return false;
+        int offset = in[ip] | in[ip + 1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > op)
+            return false;
+
+        int length = token & 15;
+        if (length == 15) {
+            uchar byte;
+            do {
+                if (ip >= srcSize)
+                    return false;
+                byte = in[ip++];
+                length += byte;
+            } while (byte == 255);
+        }
+        length += MinMatch;
+        if (length > dstSize - op)
+            return false;
+
+        // byte by byte, matches may overlap their own output
+        for (int i = 0; i < length; i++, op++)
+            dst[op] = dst[op - offset];
+    }
+
+    return op == dstSize;
+}
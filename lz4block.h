@@ -0,0 +1,42 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef LZ4BLOCK_H
+#define LZ4BLOCK_H
+
+#include <QByteArray>
+
+/*
+ * LZ4 block format (no frame header), enough for the second-stage loader:
+ * a greedy single-probe compressor on the host and a bounds-checked
+ * decompressor that a small target stub can mirror.
+ */
+class Lz4Block
+{
+public:
+    static QByteArray compress(const char *data, int size);
+    static bool decompress(const char *src, int srcSize, char *dst, int dstSize);
+
+private:
+    static void appendLength(QByteArray &out, int length);
+};
+
+#endif // LZ4BLOCK_H
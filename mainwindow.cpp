@@ -22,11 +22,17 @@
 #include <QDebug>
 #include <QTimer>
 #include <QFileDialog>
+#include <QGuiApplication>
+#include <QScreen>
+#include <QStringList>
+#include <QTextBlock>
 #include <QSerialPort>
 #include <QSerialPortInfo>
 
 #include "settings.h"
 #include "bootloader.h"
+#include "gangdialog.h"
+#include "capturewriter.h"
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
 
@@ -36,6 +42,10 @@ MainWindow::MainWindow(QWidget *parent) :
     serialPort(new QSerialPort),
     suspend(false),
     timer(new QTimer),
+    capture(new CaptureWriter),
+    filterScanned(0),
+    searchLine(-1),
+    searchTimer(new QTimer),
     bootloader(new Bootloader)
 {
     ui->setupUi(this);
@@ -47,7 +57,27 @@ MainWindow::MainWindow(QWidget *parent) :
     connect(ui->resetPushButton, SIGNAL(released()), this, SLOT(resetExitAction()));
     connect(ui->openPushButton, SIGNAL(pressed()), this, SLOT(openAction()));
     connect(ui->loadPushButton, SIGNAL(pressed()), this, SLOT(loadAction()));
+    connect(ui->gangPushButton, SIGNAL(pressed()), this, SLOT(gangAction()));
+    connect(ui->readPushButton, SIGNAL(pressed()), this, SLOT(readAction()));
+    connect(ui->differentialCheckBox, SIGNAL(toggled(bool)), this, SLOT(differentialChanged(bool)));
+    connect(ui->verifyCheckBox, SIGNAL(toggled(bool)), this, SLOT(verifyChanged(bool)));
+    connect(ui->autoBaudrateCheckBox, SIGNAL(toggled(bool)), this, SLOT(autoBaudrateChanged(bool)));
+    connect(ui->skipFlashedCheckBox, SIGNAL(toggled(bool)), this, SLOT(skipFlashedChanged(bool)));
+    connect(ui->runApplicationCheckBox, SIGNAL(toggled(bool)), this, SLOT(runApplicationChanged(bool)));
+    connect(ui->resumeCheckBox, SIGNAL(toggled(bool)), this, SLOT(resumeChanged(bool)));
+    connect(ui->timestampsCheckBox, SIGNAL(toggled(bool)), this, SLOT(timestampsChanged(bool)));
+    connect(ui->capturePushButton, SIGNAL(toggled(bool)), this, SLOT(captureAction(bool)));
+    connect(capture, SIGNAL(failed(QString)), this, SLOT(captureFailed(QString)));
     connect(ui->textEdit, SIGNAL(keyPress(int)), this, SLOT(writeSerial(int)));
+    connect(ui->clearPushButton, SIGNAL(clicked()), this, SLOT(clearConsole()));
+    connect(ui->searchLineEdit, SIGNAL(textChanged(QString)), this, SLOT(searchChanged()));
+    connect(ui->searchLineEdit, SIGNAL(returnPressed()), this, SLOT(findNext()));
+    connect(ui->regexCheckBox, SIGNAL(toggled(bool)), this, SLOT(searchChanged()));
+    connect(ui->matchCaseCheckBox, SIGNAL(toggled(bool)), this, SLOT(searchChanged()));
+    connect(ui->filterCheckBox, SIGNAL(toggled(bool)), this, SLOT(applySearch()));
+    connect(ui->findNextPushButton, SIGNAL(clicked()), this, SLOT(findNext()));
+    connect(ui->findPreviousPushButton, SIGNAL(clicked()), this, SLOT(findPrevious()));
+    connect(searchTimer, SIGNAL(timeout()), this, SLOT(applySearch()));
 
     QListIterator<QSerialPortInfo> portinfos(QSerialPortInfo::availablePorts());
     while (portinfos.hasNext()) {
@@ -81,10 +111,36 @@ MainWindow::MainWindow(QWidget *parent) :
         ui->binLineEdit->setText(filename);
     }
 
-    connect(timer, SIGNAL(timeout()), this, SLOT(readSerial()));
+    ui->differentialCheckBox->setChecked(Settings::instance()->value("Differential", false).toBool());
+    ui->verifyCheckBox->setChecked(Settings::instance()->value("Verify", false).toBool());
+    ui->autoBaudrateCheckBox->setChecked(Settings::instance()->value("AutoBaudrate", false).toBool());
+    ui->skipFlashedCheckBox->setChecked(Settings::instance()->value("SkipFlashed", false).toBool());
+    ui->runApplicationCheckBox->setChecked(Settings::instance()->value("RunApplication", false).toBool());
+    ui->resumeCheckBox->setChecked(Settings::instance()->value("Resume", false).toBool());
+    ui->timestampsCheckBox->setChecked(Settings::instance()->value("CaptureTimestamps", false).toBool());
+
+    int lines = Settings::instance()->value("ScrollbackLines", 10000).toInt();
+    int characters = Settings::instance()->value("ScrollbackCharacters", 4 * 1024 * 1024).toInt();
+    ui->textEdit->setMaximumBlockCount(lines);
+    ui->filterTextEdit->setMaximumBlockCount(lines);
+    ui->filterTextEdit->setVisible(false);
+    searchTimer->setSingleShot(true);
+    searchTimer->setInterval(150);
+    ui->textEdit->setMaximumCharacterCount(characters);
+    console.setCapacity(qMax(characters, 64 * 1024));
+
+    QScreen *screen = QGuiApplication::primaryScreen();
+    qreal refreshRate = screen ? screen->refreshRate() : 60;
+    timer->setSingleShot(true);
+    timer->setInterval(qMax(1, int(1000 / qMax(refreshRate, qreal(1)))));
+
+    connect(serialPort, SIGNAL(readyRead()), this, SLOT(readSerial()));
+    connect(timer, SIGNAL(timeout()), this, SLOT(refreshConsole()));
     connect(bootloader, SIGNAL(started()), this, SLOT(loadEnter()));
     connect(bootloader, SIGNAL(finished()), this, SLOT(loadExit()));
+    connect(bootloader, SIGNAL(portReleased()), this, SLOT(attachConsole()));
     connect(bootloader, SIGNAL(progressValue(int)), this, SLOT(loadProgress(int)));
+    connect(bootloader, SIGNAL(baudrateNegotiated(qint32)), this, SLOT(loadBaudrate(qint32)));
 
     openSerial(portName(), baudrate);
 
@@ -94,6 +150,8 @@ MainWindow::MainWindow(QWidget *parent) :
 MainWindow::~MainWindow()
 {
     delete bootloader;
+    delete capture;
+    delete searchTimer;
     delete timer;
     delete serialPort;
     delete ui;
@@ -120,17 +178,189 @@ void MainWindow::suspendSerial()
         ui->suspendPushButton->setText(tr("Suspend"));
 }
 
+/*
+ * Drain the port on every readyRead so the driver never backs up, but only
+ * repaint once per display frame.
+ */
 void MainWindow::readSerial()
 {
-    if (serialPort->isOpen() && serialPort->bytesAvailable()) {
-        if (!suspend) {
-            ui->textEdit->moveCursor(QTextCursor::End);
-            ui->textEdit->insertPlainText(serialPort->readAll());
-            ui->textEdit->moveCursor(QTextCursor::End);
-        } else {
-            serialPort->readAll();
+    char chunk[4096];
+    qint64 size;
+
+    while ((size = serialPort->read(chunk, sizeof(chunk))) > 0) {
+        capture->write(chunk, int(size));
+        if (!suspend)
+            console.write(chunk, int(size));
+    }
+
+    if (!console.isEmpty() && !timer->isActive())
+        timer->start();
+}
+
+void MainWindow::refreshConsole()
+{
+    qint64 dropped = console.takeDropped();
+    if (dropped)
+        appendConsole(QString("\n[%1 bytes dropped]\n").arg(dropped).toLatin1());
+    if (!console.isEmpty())
+        appendConsole(console.readAll());
+    if (!filterMatcher.isEmpty())
+        updateFilter();
+}
+
+/*
+ * The index sees exactly what the view shows, so a line number counted from
+ * the end of the index is also a block counted from the end of the view.
+ */
+void MainWindow::appendConsole(const QByteArray &data)
+{
+    ui->textEdit->appendData(data);
+    logIndex.append(data);
+}
+
+void MainWindow::clearConsole()
+{
+    ui->textEdit->clear();
+    ui->filterTextEdit->clear();
+    logIndex.clear();
+    filterMatches.clear();
+    filterScanned = logIndex.lineCount();
+    searchLine = -1;
+}
+
+void MainWindow::searchChanged()
+{
+    searchLine = -1;
+    searchTimer->start();
+}
+
+LineMatcher MainWindow::searchMatcher() const
+{
+    return LineMatcher(ui->searchLineEdit->text(),
+                       ui->regexCheckBox->isChecked(),
+                       ui->matchCaseCheckBox->isChecked());
+}
+
+/*
+ * Rebuild the filter view. While a plain pattern is being extended only the
+ * previous hits need re-testing; anything else scans the index once, and new
+ * lines are matched incrementally by updateFilter() as they arrive.
+ */
+void MainWindow::applySearch()
+{
+    searchTimer->stop();
+    const LineMatcher &matcher = searchMatcher();
+    if (!matcher.isValid()) {
+        ui->statusBar->showMessage(tr("Invalid regular expression"));
+        return;
+    }
+
+    bool filter = ui->filterCheckBox->isChecked() && !matcher.isEmpty();
+    ui->filterTextEdit->setVisible(filter);
+    ui->filterTextEdit->clear();
+    if (!filter) {
+        filterMatcher = LineMatcher();
+        filterMatches.clear();
+        ui->statusBar->clearMessage();
+        return;
+    }
+
+    QVector<qint64> matches;
+    qint64 scanned = logIndex.firstLine();
+    if (!filterMatcher.isEmpty() && matcher.narrows(filterMatcher)) {
+        foreach (qint64 number, filterMatches) {
+            if (number < logIndex.firstLine())
+                continue;
+            const QByteArray &line = logIndex.line(number);
+            if (matcher.matches(line.constData(), line.size()))
+                matches.append(number);
         }
+        scanned = qMax(filterScanned, scanned);
+    }
+    logIndex.collect(matcher, scanned, logIndex.completeLines(), matches);
+
+    filterMatcher = matcher;
+    filterMatches = matches;
+    filterScanned = logIndex.completeLines();
+
+    QStringList lines;
+    int shown = filterMatches.size();
+    if (ui->filterTextEdit->maximumBlockCount() > 0)
+        shown = qMin(shown, ui->filterTextEdit->maximumBlockCount());
+    for (int i = filterMatches.size() - shown; i < filterMatches.size(); i++)
+        lines << QString("%1: %2").arg(filterMatches.at(i) + 1).arg(QString::fromUtf8(logIndex.line(filterMatches.at(i))));
+    if (!lines.isEmpty())
+        ui->filterTextEdit->appendPlainText(lines.join("\n"));
+    ui->statusBar->showMessage(tr("%1 matching lines").arg(filterMatches.size()));
+}
+
+void MainWindow::updateFilter()
+{
+    QVector<qint64> matches;
+    logIndex.collect(filterMatcher, filterScanned, logIndex.completeLines(), matches);
+    filterScanned = logIndex.completeLines();
+    if (matches.isEmpty())
+        return;
+
+    int stale = 0;
+    while (stale < filterMatches.size() && filterMatches.at(stale) < logIndex.firstLine())
+        stale++;
+    filterMatches.remove(0, stale);
+    filterMatches += matches;
+
+    QStringList lines;
+    foreach (qint64 number, matches)
+        lines << QString("%1: %2").arg(number + 1).arg(QString::fromUtf8(logIndex.line(number)));
+    ui->filterTextEdit->appendPlainText(lines.join("\n"));
+    ui->statusBar->showMessage(tr("%1 matching lines").arg(filterMatches.size()));
+}
+
+void MainWindow::findNext()
+{
+    const LineMatcher &matcher = searchMatcher();
+    if (matcher.isEmpty() || !matcher.isValid())
+        return;
+
+    QVector<qint64> lines;
+    logIndex.collect(matcher, qMax(searchLine + 1, logIndex.firstLine()), logIndex.lineCount(), lines, 1);
+    if (lines.isEmpty()) {
+        ui->statusBar->showMessage(tr("No further match"));
+        return;
+    }
+    showLine(lines.first());
+}
+
+void MainWindow::findPrevious()
+{
+    const LineMatcher &matcher = searchMatcher();
+    if (matcher.isEmpty() || !matcher.isValid())
+        return;
+
+    qint64 from = searchLine < 0 ? logIndex.lineCount() - 1 : searchLine - 1;
+    qint64 number = logIndex.findPrevious(matcher, from);
+    if (number < 0) {
+        ui->statusBar->showMessage(tr("No earlier match"));
+        return;
+    }
+    showLine(number);
+}
+
+void MainWindow::showLine(qint64 number)
+{
+    searchLine = number;
+    qint64 fromEnd = logIndex.lineCount() - 1 - number;
+    qint64 block = ui->textEdit->blockCount() - 1 - fromEnd;
+    if (block < 0) {
+        ui->statusBar->showMessage(tr("Line %1 is no longer in the scrollback: %2")
+                                   .arg(number + 1).arg(QString::fromUtf8(logIndex.line(number))));
+        return;
     }
+
+    QTextCursor cursor(ui->textEdit->document()->findBlockByNumber(int(block)));
+    cursor.movePosition(QTextCursor::EndOfBlock, QTextCursor::KeepAnchor);
+    ui->textEdit->setTextCursor(cursor);
+    ui->textEdit->centerCursor();
+    ui->statusBar->showMessage(tr("Line %1").arg(number + 1));
 }
 
 void MainWindow::writeSerial(int key)
@@ -165,9 +395,82 @@ void MainWindow::resetExitAction()
     }
 }
 
+void MainWindow::differentialChanged(bool checked)
+{
+    Settings::instance()->setValue("Differential", checked);
+}
+
+void MainWindow::verifyChanged(bool checked)
+{
+    Settings::instance()->setValue("Verify", checked);
+}
+
+void MainWindow::autoBaudrateChanged(bool checked)
+{
+    Settings::instance()->setValue("AutoBaudrate", checked);
+}
+
+void MainWindow::skipFlashedChanged(bool checked)
+{
+    Settings::instance()->setValue("SkipFlashed", checked);
+}
+
+void MainWindow::runApplicationChanged(bool checked)
+{
+    Settings::instance()->setValue("RunApplication", checked);
+}
+
+void MainWindow::resumeChanged(bool checked)
+{
+    Settings::instance()->setValue("Resume", checked);
+}
+
+void MainWindow::timestampsChanged(bool checked)
+{
+    Settings::instance()->setValue("CaptureTimestamps", checked);
+}
+
+void MainWindow::captureAction(bool checked)
+{
+    if (!checked) {
+        capture->close();
+        ui->timestampsCheckBox->setEnabled(true);
+        return;
+    }
+
+    const QString &filename = QFileDialog::getSaveFileName(this, "",
+                                                           Settings::instance()->value("CaptureFilename").toString(),
+                                                           "Log (*.log *.txt);;All (*)",
+                                                           0, QFileDialog::DontConfirmOverwrite);
+    if (filename.isEmpty()) {
+        ui->capturePushButton->setChecked(false);
+        return;
+    }
+
+    if (!capture->open(filename, ui->timestampsCheckBox->isChecked())) {
+        qDebug() << "Capture open:" << capture->errorString();
+        ui->capturePushButton->setChecked(false);
+        return;
+    }
+
+    Settings::instance()->setValue("CaptureFilename", filename);
+    ui->timestampsCheckBox->setEnabled(false);
+}
+
+void MainWindow::captureFailed(const QString &error)
+{
+    qDebug() << "Capture write:" << error;
+    ui->capturePushButton->setChecked(false);
+}
+
 void MainWindow::openAction()
 {
-    const QString &filename = QFileDialog::getOpenFileName(this, "", "", "Bin Format (*.bin)");
+    const QString &filename = QFileDialog::getOpenFileName(this, "", "",
+                                                           "Firmware (*.bin *.hex *.ihex *.s19 *.s28 *.s37 *.srec *.elf *.axf);;"
+                                                           "Bin Format (*.bin);;"
+                                                           "Intel HEX (*.hex *.ihex);;"
+                                                           "Motorola S-record (*.s19 *.s28 *.s37 *.srec);;"
+                                                           "ELF (*.elf *.axf)");
     if (filename.size() != 0) {
         Settings::instance()->setValue("Filename", filename);
         ui->binLineEdit->setText(filename);
@@ -179,12 +482,39 @@ void MainWindow::loadAction()
     closeSerial();
     ui->openPushButton->setDisabled(true);
     ui->loadPushButton->setDisabled(true);
-    bootloader->setPortName(portName());
-    bootloader->setBaudrate(baudrate());
-    bootloader->setFilename(filename());
+    ui->readPushButton->setDisabled(true);
+    ui->gangPushButton->setDisabled(true);
+    setupBootloader();
+    bootloader->start();
+}
+
+void MainWindow::readAction()
+{
+    const QString &filename = QFileDialog::getSaveFileName(this, "", "",
+                                                           "Bin Format (*.bin);;"
+                                                           "Intel HEX (*.hex)");
+    if (filename.isEmpty())
+        return;
+
+    closeSerial();
+    ui->openPushButton->setDisabled(true);
+    ui->loadPushButton->setDisabled(true);
+    ui->readPushButton->setDisabled(true);
+    ui->gangPushButton->setDisabled(true);
+    setupBootloader();
+    bootloader->setReadoutFilename(filename);
     bootloader->start();
 }
 
+void MainWindow::gangAction()
+{
+    closeSerial();
+    setupBootloader();
+    GangDialog dialog(bootloader, filename(), ui->autoBaudrateCheckBox->isChecked(), this);
+    dialog.exec();
+    openSerial(portName(), baudrate());
+}
+
 void MainWindow::loadEnter()
 {
     int minimum, maximum;
@@ -199,9 +529,24 @@ void MainWindow::loadExit()
     ui->progressBar->setVisible(false);
     ui->openPushButton->setEnabled(true);
     ui->loadPushButton->setEnabled(true);
+    ui->readPushButton->setEnabled(true);
+    ui->gangPushButton->setEnabled(true);
+    if (bootloader->isSucceeded() && !bootloader->isReadout())
+        Settings::instance()->countAdapterSession(bootloader->port());
+}
+
+/*
+ * Runs as soon as the engine closes the port, ahead of the thread's own
+ * teardown. When the application was started with Go there is nothing to
+ * reset; otherwise pulse RTS as before.
+ */
+void MainWindow::attachConsole()
+{
     openSerial(portName(), baudrate());
-    resetEnterAction();
-    QTimer::singleShot(50, this, SLOT(resetExitAction()));
+    if (!bootloader->applicationStarted()) {
+        resetEnterAction();
+        QTimer::singleShot(50, this, SLOT(resetExitAction()));
+    }
 }
 
 void MainWindow::loadProgress(int value)
@@ -209,6 +554,11 @@ void MainWindow::loadProgress(int value)
     ui->progressBar->setValue(value);
 }
 
+void MainWindow::loadBaudrate(qint32 baudrate)
+{
+    Settings::instance()->setAdapterBaudrate(bootloader->port(), baudrate);
+}
+
 QString MainWindow::portName() const
 {
     return ui->portComboBox->currentText();
@@ -224,6 +574,23 @@ QString MainWindow::filename() const
     return ui->binLineEdit->text();
 }
 
+void MainWindow::setupBootloader()
+{
+    bootloader->setPortName(portName());
+    bootloader->setBaudrate(baudrate());
+    bootloader->setFilename(filename());
+    bootloader->setDifferential(ui->differentialCheckBox->isChecked());
+    bootloader->setVerify(ui->verifyCheckBox->isChecked());
+    bootloader->setSkipFlashed(ui->skipFlashedCheckBox->isChecked());
+    bootloader->setRunApplication(ui->runApplicationCheckBox->isChecked());
+    bootloader->setResume(ui->resumeCheckBox->isChecked());
+    bootloader->setReadoutFilename(QString());
+    if (ui->autoBaudrateCheckBox->isChecked())
+        bootloader->setBaudrates(Settings::instance()->autoBaudrates(portName()));
+    else
+        bootloader->setBaudrates(QList<qint32>());
+}
+
 void MainWindow::openSerial(const QString &port, qint32 baudrate)
 {
     closeSerial();
@@ -242,14 +609,13 @@ void MainWindow::openSerial(const QString &port, qint32 baudrate)
     serialPort->setDataTerminalReady(false);
     serialPort->setRequestToSend(false);
 
-    timer->start(50);
-
     qDebug() << "serialPort open:" << port << baudrate;
 }
 
 void MainWindow::closeSerial()
 {
     timer->stop();
+    refreshConsole();
 
     if (serialPort->isOpen()) {
         serialPort->close();
@@ -24,6 +24,9 @@
 
 #include <QMainWindow>
 
+#include "ringbuffer.h"
+#include "lineindex.h"
+
 namespace Ui {
 class MainWindow;
 }
@@ -31,6 +34,7 @@ class MainWindow;
 class QSerialPort;
 class QTimer;
 class Bootloader;
+class CaptureWriter;
 
 class MainWindow : public QMainWindow
 {
@@ -45,28 +49,60 @@ public Q_SLOTS:
     void baudrateChanged(const QString &text);
     void suspendSerial();
     void readSerial();
+    void refreshConsole();
     void writeSerial(int key);
     void writeSerial(const QString &data);
     void resetEnterAction();
     void resetExitAction();
+    void differentialChanged(bool checked);
+    void verifyChanged(bool checked);
+    void autoBaudrateChanged(bool checked);
+    void skipFlashedChanged(bool checked);
+    void runApplicationChanged(bool checked);
+    void resumeChanged(bool checked);
+    void timestampsChanged(bool checked);
+    void captureAction(bool checked);
+    void captureFailed(const QString &error);
+    void searchChanged();
+    void applySearch();
+    void findNext();
+    void findPrevious();
+    void clearConsole();
     void openAction();
     void loadAction();
+    void readAction();
+    void gangAction();
     void loadEnter();
     void loadExit();
+    void attachConsole();
     void loadProgress(int value);
+    void loadBaudrate(qint32 baudrate);
 
 private:
     QString portName() const;
     qint32 baudrate() const;
     QString filename() const;
+    void setupBootloader();
     void openSerial(const QString &port, qint32 baudrate);
     void closeSerial();
+    void appendConsole(const QByteArray &data);
+    LineMatcher searchMatcher() const;
+    void updateFilter();
+    void showLine(qint64 number);
 
 private:
     Ui::MainWindow *ui;
     QSerialPort *serialPort;
     bool suspend;
     QTimer *timer;
+    RingBuffer console;
+    CaptureWriter *capture;
+    LineIndex logIndex;
+    LineMatcher filterMatcher;
+    QVector<qint64> filterMatches;
+    qint64 filterScanned;
+    qint64 searchLine;
+    QTimer *searchTimer;
     Bootloader *bootloader;
 };
 
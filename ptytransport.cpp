@@ -0,0 +1,200 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <QFile>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "ptytransport.h"
+
+PtyTransport::PtyTransport(const QString &path) :
+    path(path),
+    fd(-1),
+    baudrate(0)
+{
+
+}
+
+PtyTransport::~PtyTransport()
+{
+    close();
+}
+
+bool PtyTransport::open(qint32 baudrate)
+{
+    fd = ::open(QFile::encodeName(path).constData(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0) {
+        error = QString::fromLocal8Bit(strerror(errno));
+        return false;
+    }
+
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tio.c_cflag |= PARENB | CLOCAL | CREAD;
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+
+    setBaudRate(baudrate);
+    error.clear();
+    return true;
+}
+
+void PtyTransport::close()
+{
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+/*
+ * The rate carries no meaning on a pty, but it is still set on the line so
+ * the far end (the simulator) can pace itself by it. Rates without a
+ * termios constant keep the previous setting.
+ */
+bool PtyTransport::setBaudRate(qint32 baudrate)
+{
+    static const struct {
+        qint32 baudrate;
+        speed_t speed;
+    } speeds[] = {
+        { 1200, B1200 }, { 2400, B2400 }, { 4800, B4800 }, { 9600, B9600 },
+        { 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 },
+        { 115200, B115200 }, { 230400, B230400 },
+#ifdef B460800
+        { 460800, B460800 }, { 921600, B921600 },
+#endif
+#ifdef B1000000
+        { 1000000, B1000000 }, { 2000000, B2000000 },
+        { 3000000, B3000000 }, { 4000000, B4000000 }
+#endif
+    };
+
+    struct termios tio;
+    if (fd >= 0 && tcgetattr(fd, &tio) == 0) {
+        for (size_t i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+            if (speeds[i].baudrate == baudrate) {
+                cfsetispeed(&tio, speeds[i].speed);
+                cfsetospeed(&tio, speeds[i].speed);
+                tcsetattr(fd, TCSANOW, &tio);
+                break;
+            }
+        }
+    }
+
+    this->baudrate = baudrate;
+    return true;
+}
+
+qint32 PtyTransport::baudRate() const
+{
+    return baudrate;
+}
+
+void PtyTransport::setDataTerminalReady(bool set)
+{
+    Q_UNUSED(set);
+}
+
+void PtyTransport::setRequestToSend(bool set)
+{
+    Q_UNUSED(set);
+}
+
+/*
+ * One write() per frame; the loop only runs when the pty buffer is full.
+ */
+qint64 PtyTransport::write(const char *data, qint64 size)
+{
+    qint64 written = 0;
+    while (written < size) {
+        ssize_t n = ::write(fd, data + written, size - written);
+        if (n > 0) {
+            written += n;
+        } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+            error = QString::fromLocal8Bit(strerror(errno));
+            return written ? written : -1;
+        } else if (!poll(POLLOUT, 100)) {
+            break;
+        }
+    }
+    return written;
+}
+
+qint64 PtyTransport::read(char *data, qint64 maxSize)
+{
+    ssize_t n = ::read(fd, data, maxSize);
+    if (n < 0)
+        return errno == EAGAIN || errno == EINTR ? 0 : -1;
+    return n;
+}
+
+qint64 PtyTransport::bytesAvailable()
+{
+    int count = 0;
+    if (fd < 0 || ioctl(fd, FIONREAD, &count) < 0)
+        return 0;
+    return count;
+}
+
+bool PtyTransport::waitForReadyRead(int msecs)
+{
+    return poll(POLLIN, msecs);
+}
+
+bool PtyTransport::waitForBytesWritten(int msecs)
+{
+    Q_UNUSED(msecs);
+    return fd >= 0;
+}
+
+void PtyTransport::discardInput()
+{
+    char buf[256];
+    tcflush(fd, TCIFLUSH);
+    while (::read(fd, buf, sizeof(buf)) > 0)
+        ;
+}
+
+QString PtyTransport::errorString() const
+{
+    return error;
+}
+
+bool PtyTransport::poll(short events, int msecs)
+{
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = events;
+    pfd.revents = 0;
+    int n;
+    do {
+        n = ::poll(&pfd, 1, msecs);
+    } while (n < 0 && errno == EINTR);
+    return n > 0 && (pfd.revents & events);
+}
@@ -0,0 +1,61 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef PTYTRANSPORT_H
+#define PTYTRANSPORT_H
+
+#include "transport.h"
+
+/*
+ * Pseudo-terminal opened with termios directly, for the simulator and
+ * socat bridges. A pty has no modem lines and its line rate is only
+ * advisory, so boot entry reduces to flushing the input.
+ */
+class PtyTransport : public Transport
+{
+public:
+    explicit PtyTransport(const QString &path);
+    virtual ~PtyTransport();
+
+    virtual bool open(qint32 baudrate);
+    virtual void close();
+    virtual bool setBaudRate(qint32 baudrate);
+    virtual qint32 baudRate() const;
+    virtual void setDataTerminalReady(bool set);
+    virtual void setRequestToSend(bool set);
+    virtual qint64 write(const char *data, qint64 size);
+    virtual qint64 read(char *data, qint64 maxSize);
+    virtual qint64 bytesAvailable();
+    virtual bool waitForReadyRead(int msecs);
+    virtual bool waitForBytesWritten(int msecs);
+    virtual void discardInput();
+    virtual QString errorString() const;
+
+private:
+    bool poll(short events, int msecs);
+
+    QString path;
+    int fd;
+    qint32 baudrate;
+    QString error;
+};
+
+#endif // PTYTRANSPORT_H
@@ -0,0 +1,42 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef QTCOMPAT_H
+#define QTCOMPAT_H
+
+#include <QString>
+#include <QTextStream>
+
+/*
+ * Qt 5.14 moved the stream manipulators and split behaviour into the Qt
+ * namespace and deprecated the old names; older Qt gets the new names
+ * as aliases so the code can use them unconditionally.
+ */
+#if QT_VERSION < QT_VERSION_CHECK(5, 14, 0)
+namespace Qt {
+using ::endl;
+using ::hex;
+using ::dec;
+const QString::SplitBehavior SkipEmptyParts = QString::SkipEmptyParts;
+}
+#endif
+
+#endif // QTCOMPAT_H
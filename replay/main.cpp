@@ -0,0 +1,185 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QTextStream>
+#include <QThread>
+
+#include "responseparser.h"
+#include "wiretrace.h"
+#include "qtcompat.h"
+
+struct Run
+{
+    qint64 nsecs;
+    int direction;
+    QByteArray data;
+};
+
+/*
+ * Slots of one run share a timestamp and direction; stitch them back so
+ * frames are printed the way they were sent and received.
+ */
+static QList<Run> mergeRuns(const QVector<WireTrace::Record> &records)
+{
+    QList<Run> runs;
+    foreach (const WireTrace::Record &record, records) {
+        if (!runs.isEmpty() && runs.last().nsecs == record.nsecs
+                && runs.last().direction == record.direction
+                && runs.last().data.size() % WireTrace::SlotDataSize == 0) {
+            runs.last().data.append(record.data, record.size);
+            continue;
+        }
+        Run run;
+        run.nsecs = record.nsecs;
+        run.direction = record.direction;
+        run.data = QByteArray(record.data, record.size);
+        runs.append(run);
+    }
+    return runs;
+}
+
+static QString timestamp(qint64 nsecs)
+{
+    return QString("%1").arg(nsecs / 1000000.0, 12, 'f', 3);
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("stm32replay");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Replay a wire trace saved by the bootloader through the response parser.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("trace", "Wire trace file.");
+
+    QCommandLineOption realtimeOption("realtime", "Pace the replay with the recorded timestamps.");
+    QCommandLineOption quietOption(QStringList() << "q" << "quiet", "Only print NACKs, timeouts and the summary.");
+    parser.addOption(realtimeOption);
+    parser.addOption(quietOption);
+    parser.process(app);
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+    if (parser.positionalArguments().size() != 1) {
+        err << "One trace file is required" << Qt::endl;
+        return 1;
+    }
+
+    QVector<WireTrace::Record> records;
+    QString error;
+    if (!WireTrace::load(parser.positionalArguments().first(), records, &error)) {
+        err << error << Qt::endl;
+        return 1;
+    }
+
+    const bool realtime = parser.isSet(realtimeOption);
+    const bool quiet = parser.isSet(quietOption);
+    ResponseParser response;
+    QByteArray payload;
+    qint64 lastTx = 0;
+    qint64 maxLatency = 0;
+    int acks = 0, nacks = 0, timeouts = 0;
+    // Read Memory answers raw data after its third ACK
+    int acksBeforeData = -1;
+    int dataSize = 0;
+    qint64 start = records.isEmpty() ? 0 : records.first().nsecs;
+    QElapsedTimer clock;
+    clock.start();
+
+    foreach (const Run &run, mergeRuns(records)) {
+        if (realtime) {
+            qint64 ahead = (run.nsecs - start) - clock.nsecsElapsed();
+            if (ahead > 0)
+                QThread::usleep(ahead / 1000);
+        }
+
+        switch (run.direction) {
+        case WireTrace::Marker:
+            if (run.data == "timeout") {
+                timeouts++;
+                out << timestamp(run.nsecs) << "  timeout, pending " << response.pending().toHex() << Qt::endl;
+            } else {
+                if (!quiet)
+                    out << timestamp(run.nsecs) << "  -- " << run.data << " --" << Qt::endl;
+                if (run.data == "boot" || run.data == "resync") {
+                    response.clear();
+                    acksBeforeData = -1;
+                }
+            }
+            break;
+        case WireTrace::Tx:
+            lastTx = run.nsecs;
+            if (!quiet)
+                out << timestamp(run.nsecs) << "  TX " << run.data.toHex() << Qt::endl;
+            if (run.data.size() == 2 && run.data.at(0) == 0x11 && run.data.at(1) == char(0xee)) {
+                acksBeforeData = 3;
+            } else if (acksBeforeData > 0 && run.data.size() == 2 && run.data.at(1) == char(~run.data.at(0))) {
+                dataSize = quint8(run.data.at(0)) + 1;
+            }
+            break;
+        case WireTrace::Rx:
+            if (!quiet)
+                out << timestamp(run.nsecs) << "  RX " << run.data.toHex() << Qt::endl;
+            response.append(run.data.constData(), run.data.size());
+            forever {
+                if (acksBeforeData == 0) {
+                    if (!response.takeBytes(dataSize, payload))
+                        break;
+                    if (!quiet)
+                        out << timestamp(run.nsecs) << "     data " << payload.size() << " bytes" << Qt::endl;
+                    acksBeforeData = -1;
+                    continue;
+                }
+
+                ResponseParser::Frame frame = response.takeFrame(payload);
+                if (frame == ResponseParser::NoFrame)
+                    break;
+
+                qint64 latency = run.nsecs - lastTx;
+                maxLatency = qMax(maxLatency, latency);
+                if (frame == ResponseParser::AckFrame) {
+                    acks++;
+                    if (acksBeforeData > 0)
+                        acksBeforeData--;
+                    if (!quiet)
+                        out << timestamp(run.nsecs) << "     ACK after " << latency / 1000 << " us"
+                            << (payload.isEmpty() ? QString() : QString(", payload " + payload.toHex())) << Qt::endl;
+                } else {
+                    nacks++;
+                    acksBeforeData = -1;
+                    out << timestamp(run.nsecs) << "     NACK after " << latency / 1000 << " us"
+                        << (payload.isEmpty() ? QString() : QString(", payload " + payload.toHex())) << Qt::endl;
+                }
+            }
+            break;
+        }
+    }
+
+    out << records.size() << " records, " << acks << " ACK, " << nacks << " NACK, "
+        << timeouts << " timeouts, max reply latency " << maxLatency / 1000 << " us" << Qt::endl;
+
+    return nacks || timeouts ? 2 : 0;
+}
@@ -0,0 +1,24 @@
+#-------------------------------------------------
+#
+# Offline replay of bootloader wire traces
+#
+#-------------------------------------------------
+
+QT       += core
+QT       -= gui
+
+TARGET = stm32replay
+TEMPLATE = app
+CONFIG   += console
+CONFIG   -= app_bundle
+
+INCLUDEPATH += ..
+DEPENDPATH += ..
+
+SOURCES += main.cpp \
+    ../responseparser.cpp \
+    ../wiretrace.cpp
+
+HEADERS += ../responseparser.h \
+    ../wiretrace.h \
+    ../qtcompat.h
@@ -0,0 +1,74 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include "responseparser.h"
+
+const char Ack = 0x79;
+const char Nack = 0x1f;
+
+ResponseParser::ResponseParser() :
+    pos(0)
+{
+    buffer.reserve(4096);
+}
+
+void ResponseParser::clear()
+{
+    buffer.resize(0);
+    pos = 0;
+}
+
+void ResponseParser::append(const char *data, int size)
+{
+    if (pos > 0) {
+        buffer.remove(0, pos);
+        pos = 0;
+    }
+    buffer.append(data, size);
+}
+
+ResponseParser::Frame ResponseParser::takeFrame(QByteArray &payload)
+{
+    const char *data = buffer.constData();
+    int size = buffer.size();
+
+    for (int i = pos; i < size; i++) {
+        if (data[i] == Ack || data[i] == Nack) {
+            payload.resize(0);
+            payload.append(data + pos, i - pos);
+            pos = i + 1;
+            return data[i] == Ack ? AckFrame : NackFrame;
+        }
+    }
+
+    return NoFrame;
+}
+
+bool ResponseParser::takeBytes(int size, QByteArray &payload)
+{
+    if (bytesAvailable() < size)
+        return false;
+
+    payload.resize(0);
+    payload.append(buffer.constData() + pos, size);
+    pos += size;
+    return true;
+}
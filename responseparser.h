@@ -0,0 +1,68 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef RESPONSEPARSER_H
+#define RESPONSEPARSER_H
+
+#include <QByteArray>
+
+class ResponseParser
+{
+public:
+    enum Frame {
+        NoFrame,
+        AckFrame,
+        NackFrame
+    };
+
+    ResponseParser();
+
+    void clear();
+    void append(const char *data, int size);
+    Frame takeFrame(QByteArray &payload);
+    bool takeBytes(int size, QByteArray &payload);
+
+    int bytesAvailable() const
+    {
+        return buffer.size() - pos;
+    }
+
+    QByteArray pending() const
+    {
+        return buffer.mid(pos);
+    }
+
+    const char *data() const
+    {
+        return buffer.constData() + pos;
+    }
+
+    void discard(int size)
+    {
+        pos += qMin(size, bytesAvailable());
+    }
+
+private:
+    QByteArray buffer;
+    int pos;
+};
+
+#endif // RESPONSEPARSER_H
@@ -0,0 +1,88 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <cstring>
+
+#include "ringbuffer.h"
+
+RingBuffer::RingBuffer(int capacity) :
+    head(0),
+    count(0),
+    dropped(0)
+{
+    setCapacity(capacity);
+}
+
+void RingBuffer::setCapacity(int capacity)
+{
+    storage.resize(capacity);
+    clear();
+}
+
+void RingBuffer::clear()
+{
+    head = 0;
+    count = 0;
+    dropped = 0;
+}
+
+void RingBuffer::write(const char *data, int size)
+{
+    int capacity = storage.size();
+    if (capacity == 0) {
+        dropped += size;
+        return;
+    }
+
+    if (size > capacity) {
+        dropped += size - capacity;
+        data += size - capacity;
+        size = capacity;
+    }
+
+    char *base = storage.data();
+    int first = qMin(size, capacity - head);
+    memcpy(base + head, data, first);
+    memcpy(base, data + first, size - first);
+    head = (head + size) % capacity;
+
+    count += size;
+    if (count > capacity) {
+        dropped += count - capacity;
+        count = capacity;
+    }
+}
+
+QByteArray RingBuffer::readAll()
+{
+    QByteArray data;
+    if (count == 0)
+        return data;
+
+    int capacity = storage.size();
+    int tail = (head - count + capacity) % capacity;
+    int first = qMin(count, capacity - tail);
+    data.reserve(count);
+    data.append(storage.constData() + tail, first);
+    data.append(storage.constData(), count - first);
+    count = 0;
+    return data;
+}
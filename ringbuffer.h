@@ -0,0 +1,70 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <QByteArray>
+
+/*
+ * Fixed capacity byte ring. Writes never block or grow the storage; when the
+ * reader falls behind the oldest bytes are overwritten and counted.
+ */
+class RingBuffer
+{
+public:
+    explicit RingBuffer(int capacity = 0);
+
+    void setCapacity(int capacity);
+    void clear();
+    void write(const char *data, int size);
+    QByteArray readAll();
+
+    qint64 takeDropped()
+    {
+        qint64 bytes = dropped;
+        dropped = 0;
+        return bytes;
+    }
+
+    int capacity() const
+    {
+        return storage.size();
+    }
+
+    int size() const
+    {
+        return count;
+    }
+
+    bool isEmpty() const
+    {
+        return count == 0;
+    }
+
+private:
+    QByteArray storage;
+    int head;
+    int count;
+    qint64 dropped;
+};
+
+#endif // RINGBUFFER_H
@@ -0,0 +1,104 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include "serialtransport.h"
+
+SerialTransport::SerialTransport(const QString &portName)
+{
+    port.setPortName(portName);
+}
+
+bool SerialTransport::open(qint32 baudrate)
+{
+    port.setBaudRate(baudrate);
+    port.setDataBits(QSerialPort::Data8);
+    port.setFlowControl(QSerialPort::NoFlowControl);
+    port.setParity(QSerialPort::EvenParity);
+    port.setStopBits(QSerialPort::OneStop);
+    return port.open(QIODevice::ReadWrite);
+}
+
+void SerialTransport::close()
+{
+    if (port.isOpen())
+        port.close();
+}
+
+bool SerialTransport::setBaudRate(qint32 baudrate)
+{
+    return port.setBaudRate(baudrate);
+}
+
+qint32 SerialTransport::baudRate() const
+{
+    return port.baudRate();
+}
+
+void SerialTransport::setDataTerminalReady(bool set)
+{
+    port.setDataTerminalReady(set);
+}
+
+void SerialTransport::setRequestToSend(bool set)
+{
+    port.setRequestToSend(set);
+}
+
+/*
+ * QSerialPort queues the data; flush() then writes the whole queue
+ * without waiting for the event loop.
+ */
+qint64 SerialTransport::write(const char *data, qint64 size)
+{
+    qint64 written = port.write(data, size);
+    port.flush();
+    return written;
+}
+
+qint64 SerialTransport::read(char *data, qint64 maxSize)
+{
+    return port.read(data, maxSize);
+}
+
+qint64 SerialTransport::bytesAvailable()
+{
+    return port.bytesAvailable();
+}
+
+bool SerialTransport::waitForReadyRead(int msecs)
+{
+    return port.waitForReadyRead(msecs);
+}
+
+bool SerialTransport::waitForBytesWritten(int msecs)
+{
+    return !port.bytesToWrite() || port.waitForBytesWritten(msecs);
+}
+
+void SerialTransport::discardInput()
+{
+    port.readAll();
+}
+
+QString SerialTransport::errorString() const
+{
+    return port.errorString();
+}
@@ -0,0 +1,52 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef SERIALTRANSPORT_H
+#define SERIALTRANSPORT_H
+
+#include <QSerialPort>
+
+#include "transport.h"
+
+class SerialTransport : public Transport
+{
+public:
+    explicit SerialTransport(const QString &portName);
+
+    virtual bool open(qint32 baudrate);
+    virtual void close();
+    virtual bool setBaudRate(qint32 baudrate);
+    virtual qint32 baudRate() const;
+    virtual void setDataTerminalReady(bool set);
+    virtual void setRequestToSend(bool set);
+    virtual qint64 write(const char *data, qint64 size);
+    virtual qint64 read(char *data, qint64 maxSize);
+    virtual qint64 bytesAvailable();
+    virtual bool waitForReadyRead(int msecs);
+    virtual bool waitForBytesWritten(int msecs);
+    virtual void discardInput();
+    virtual QString errorString() const;
+
+private:
+    QSerialPort port;
+};
+
+#endif // SERIALTRANSPORT_H
@@ -19,6 +19,9 @@
  *
  */
 
+#include <QStringList>
+#include <QSerialPortInfo>
+
 #include "settings.h"
 
 Settings *Settings::self = 0;
@@ -35,3 +38,54 @@ Settings *Settings::instance()
         self = new Settings("config.ini");
     return self;
 }
+
+/*
+ * The full configured ladder, fastest first, with the rate the adapter
+ * last negotiated moved to the front. After ReprobeSessions successful
+ * flash sessions the ladder is tried in plain order instead, so a rate
+ * cached after a transient fallback gives way again once a faster one
+ * succeeds.
+ */
+QList<qint32> Settings::autoBaudrates(const QString &port)
+{
+    QStringList defaults;
+    defaults << "921600" << "460800" << "230400" << "115200" << "57600";
+    const QStringList &rates = value("AutoBaudrates", defaults).toStringList();
+    qint32 cached = value(adapterKey("AdapterBaudrate", port), 0).toInt();
+
+    bool reprobe = value(adapterKey("AdapterSessions", port), 0).toInt() >= ReprobeSessions;
+
+    QList<qint32> baudrates;
+    foreach (const QString &rate, rates) {
+        qint32 baudrate = rate.toInt();
+        if (baudrate > 0 && !baudrates.contains(baudrate))
+            baudrates << baudrate;
+    }
+    if (cached > 0 && (!reprobe || !baudrates.contains(cached))) {
+        baudrates.removeAll(cached);
+        baudrates.prepend(cached);
+    }
+
+    return baudrates;
+}
+
+void Settings::setAdapterBaudrate(const QString &port, qint32 baudrate)
+{
+    setValue(adapterKey("AdapterBaudrate", port), baudrate);
+}
+
+/*
+ * Called for flash sessions that succeeded; the one that ran with the
+ * plain-order ladder starts the count over.
+ */
+void Settings::countAdapterSession(const QString &port)
+{
+    int sessions = value(adapterKey("AdapterSessions", port), 0).toInt();
+    setValue(adapterKey("AdapterSessions", port), sessions >= ReprobeSessions ? 0 : sessions + 1);
+}
+
+QString Settings::adapterKey(const QString &group, const QString &port)
+{
+    const QString &serialNumber = QSerialPortInfo(port).serialNumber();
+    return QString("%1/%2").arg(group, serialNumber.isEmpty() ? port : serialNumber);
+}
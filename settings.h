@@ -23,6 +23,7 @@
 #define SETTINGS_H
 
 #include <QSettings>
+#include <QList>
 
 class Settings : public QSettings
 {
@@ -32,6 +33,15 @@ public:
 
     static Settings *instance();
 
+    QList<qint32> autoBaudrates(const QString &port);
+    void setAdapterBaudrate(const QString &port, qint32 baudrate);
+    void countAdapterSession(const QString &port);
+
+private:
+    static const int ReprobeSessions = 16;
+
+    static QString adapterKey(const QString &group, const QString &port);
+
 private:
     Q_DISPLAY_COPY(Settings);
 
@@ -0,0 +1,153 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QStringList>
+#include <QTextStream>
+
+#include "simulator.h"
+#include "qtcompat.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("stm32sim");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("STM32 UART bootloader (AN3155) simulator on a pseudo-terminal.\n"
+                                     "Prints the slave device to use as port, then serves until killed.");
+    parser.addHelpOption();
+
+    QCommandLineOption chipIdOption("chip-id", "Product ID answered to Get ID.", "id", "0x414");
+    QCommandLineOption flashSizeOption("flash-size", "Flash size in KB.", "kb", "512");
+    QCommandLineOption pageSizeOption("page-size", "Erase page size in bytes.", "bytes", "2048");
+    QCommandLineOption sectorsOption("sectors", "Sector layout such as 4*16K,64K,7*128K, in place of "
+                                     "--flash-size and --page-size.", "layout");
+    QCommandLineOption ramSizeOption("ram-size", "SRAM size in KB.", "kb", "64");
+    QCommandLineOption uidAddressOption("uid-address", "Address of the 96-bit unique ID.", "address", "0x1ffff7e8");
+    QCommandLineOption legacyEraseOption("legacy-erase", "Offer Erase (0x43) instead of Extended Erase (0x44).");
+    QCommandLineOption erasedOnlyOption("erased-only", "Refuse to program flash that is not erased, as F0/F1/F3/L1 do.");
+    QCommandLineOption eraseTimeOption("page-erase-ms", "Time to erase one page.", "ms", "20");
+    QCommandLineOption writeTimeOption("write-us", "Time to program one Write Memory frame.", "us", "100");
+    QCommandLineOption baudrateOption("baudrate", "Simulated line rate; defaults to the rate the host sets.", "baudrate", "0");
+    QCommandLineOption maxBaudrateOption("max-baudrate", "Fail sync above this host rate.", "baudrate", "0");
+    QCommandLineOption nackOption("nack-rate", "Probability of answering a command with NACK.", "p", "0");
+    QCommandLineOption dropOption("drop-rate", "Probability of dropping each reply byte.", "p", "0");
+    QCommandLineOption timeoutOption("timeout-rate", "Probability of ignoring a command.", "p", "0");
+    QCommandLineOption seedOption("seed", "Seed for fault injection.", "seed", "1");
+    QCommandLineOption stubWindowOption("stub-window", "Frames the loader stub accepts in flight.", "frames", "8");
+    QCommandLineOption stubBlockOption("stub-block", "Largest block the loader stub writes per frame.", "bytes", "4096");
+    QCommandLineOption dumpStubOption("dump-stub", "Write a header-only loader stub image the simulator accepts, then exit.", "file");
+    QCommandLineOption verboseOption("verbose", "Log every command.");
+    parser.addOption(chipIdOption);
+    parser.addOption(flashSizeOption);
+    parser.addOption(pageSizeOption);
+    parser.addOption(sectorsOption);
+    parser.addOption(ramSizeOption);
+    parser.addOption(uidAddressOption);
+    parser.addOption(legacyEraseOption);
+    parser.addOption(erasedOnlyOption);
+    parser.addOption(eraseTimeOption);
+    parser.addOption(writeTimeOption);
+    parser.addOption(baudrateOption);
+    parser.addOption(maxBaudrateOption);
+    parser.addOption(nackOption);
+    parser.addOption(dropOption);
+    parser.addOption(timeoutOption);
+    parser.addOption(seedOption);
+    parser.addOption(stubWindowOption);
+    parser.addOption(stubBlockOption);
+    parser.addOption(dumpStubOption);
+    parser.addOption(verboseOption);
+    parser.process(app);
+
+    if (parser.isSet(dumpStubOption)) {
+        QByteArray stub(StubProtocol::ImageHeaderSize, 0);
+        StubProtocol::put32(stub.data(), 0x20002000);
+        StubProtocol::put32(stub.data() + 4, 0x20000800 + StubProtocol::ImageHeaderSize + 1);
+        StubProtocol::put32(stub.data() + StubProtocol::MagicOffset, StubProtocol::ImageMagic);
+        StubProtocol::put32(stub.data() + StubProtocol::VersionOffset, StubProtocol::Version);
+        QFile file(parser.value(dumpStubOption));
+        if (!file.open(QIODevice::WriteOnly) || file.write(stub) != stub.size()) {
+            QTextStream(stderr) << file.errorString() << Qt::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    SimulatorConfig config;
+    config.chipId = parser.value(chipIdOption).toInt(0, 0);
+    config.flashSize = parser.value(flashSizeOption).toInt() * 1024;
+    config.ramSize = parser.value(ramSizeOption).toInt() * 1024;
+    config.uniqueIdAddress = parser.value(uidAddressOption).toUInt(0, 0);
+    config.flashSizeRegister = ChipDatabase::instance()->chip(config.chipId).flashSizeRegister;
+    config.extendedErase = !parser.isSet(legacyEraseOption);
+    config.erasedOnly = parser.isSet(erasedOnlyOption);
+    config.pageEraseMsecs = parser.value(eraseTimeOption).toInt();
+    config.writeUsecs = parser.value(writeTimeOption).toInt();
+    config.baudrate = parser.value(baudrateOption).toInt();
+    config.maxBaudrate = parser.value(maxBaudrateOption).toInt();
+    config.nackRate = parser.value(nackOption).toDouble();
+    config.dropRate = parser.value(dropOption).toDouble();
+    config.timeoutRate = parser.value(timeoutOption).toDouble();
+    config.stubWindow = parser.value(stubWindowOption).toInt();
+    config.stubBlockSize = parser.value(stubBlockOption).toInt();
+    config.verbose = parser.isSet(verboseOption);
+    srand(parser.value(seedOption).toUInt());
+
+    if (config.stubWindow <= 0 || config.stubBlockSize <= 0 || config.stubBlockSize > StubProtocol::MaxPayload) {
+        QTextStream(stderr) << "Stub window and block size must be positive, blocks at most "
+                            << int(StubProtocol::MaxPayload) << " bytes" << Qt::endl;
+        return 1;
+    }
+
+    int pageSize = parser.value(pageSizeOption).toInt();
+    if (config.flashSize <= 0 || pageSize <= 0 || config.ramSize <= 0) {
+        QTextStream(stderr) << "Flash, page and RAM sizes must be positive" << Qt::endl;
+        return 1;
+    }
+
+    if (parser.isSet(sectorsOption)) {
+        if (!ChipInfo::parseSectors(parser.value(sectorsOption), 0, config.sectors) || config.sectors.isEmpty()) {
+            QTextStream(stderr) << "Bad sector layout " << parser.value(sectorsOption) << Qt::endl;
+            return 1;
+        }
+        config.flashSize = config.sectors.last().address + config.sectors.last().size;
+    } else {
+        for (int offset = 0; offset < config.flashSize; offset += pageSize) {
+            ChipInfo::Sector sector;
+            sector.address = offset;
+            sector.size = qMin(pageSize, config.flashSize - offset);
+            config.sectors.append(sector);
+        }
+    }
+
+    Simulator simulator(config);
+    if (!simulator.open())
+        return 1;
+
+    QTextStream(stdout) << simulator.slaveName() << Qt::endl;
+
+    return simulator.exec();
+}
@@ -0,0 +1,649 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <QDebug>
+
+#include "simulator.h"
+#include "firmwareimage.h"
+#include "lz4block.h"
+#include "qtcompat.h"
+
+const char Ack = 0x79;
+const char Nack = 0x1f;
+const char GetCommand = 0x00;
+const char GetVersionCommand = 0x01;
+const char GetIDCommand = 0x02;
+const char ReadMemoryCommand = 0x11;
+const char GoCommand = 0x21;
+const char WriteMemoryCommand = 0x31;
+const char EraseMemoryCommand = 0x43;
+const char ExtendedEraseMemoryCommand = 0x44;
+const char BootloaderVersion = 0x31;
+const quint32 FlashBaseAddress = 0x08000000;
+const quint32 RamBaseAddress = 0x20000000;
+const int BitsPerByte = 11;
+const int StubIdleMsecs = 5000;
+
+Simulator::Simulator(const SimulatorConfig &config) :
+    config(config),
+    master(-1),
+    synced(false),
+    flash(config.flashSize, 0xff),
+    ram(config.ramSize, 0)
+{
+    for (int i = 0; i < 12; i++)
+        uniqueId.append(0x30 + i);
+
+    int kb = config.flashSize / 1024;
+    flashSizeKb.append(char(kb & 0xff));
+    flashSizeKb.append(char(kb >> 8));
+}
+
+Simulator::~Simulator()
+{
+    if (master >= 0)
+        ::close(master);
+}
+
+bool Simulator::open()
+{
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+        qWarning() << "Cannot allocate pseudo-terminal";
+        return false;
+    }
+
+    struct termios tio;
+    tcgetattr(master, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(master, TCSANOW, &tio);
+
+    return true;
+}
+
+QString Simulator::slaveName() const
+{
+    return QString::fromLocal8Bit(ptsname(master));
+}
+
+/*
+ * The host cannot toggle RTS/DTR on a pseudo-terminal, so a 0x7f arriving
+ * where a command is expected is taken as reset plus sync. A host rate
+ * above --max-baudrate answers the sync with garbage, as a marginal
+ * adapter would.
+ */
+int Simulator::exec()
+{
+    forever {
+        char ch;
+        if (!readBytes(&ch, 1, -1))
+            return 1;
+
+        if (ch == 0x7f) {
+            wire(1);
+            if (config.maxBaudrate > 0 && hostBaudrate() > config.maxBaudrate) {
+                synced = false;
+                sendByte(0x00);
+            } else {
+                synced = true;
+                ack();
+            }
+            continue;
+        }
+
+        if (!synced)
+            continue;
+
+        char complement;
+        if (!readBytes(&complement, 1))
+            continue;
+        wire(2);
+        if (uchar(complement) != uchar(~ch)) {
+            nack();
+            continue;
+        }
+
+        if (fault(config.timeoutRate)) {
+            if (config.verbose)
+                qDebug() << "Inject timeout on command" << Qt::hex << uchar(ch);
+            continue;
+        }
+        if (fault(config.nackRate)) {
+            if (config.verbose)
+                qDebug() << "Inject nack on command" << Qt::hex << uchar(ch);
+            nack();
+            continue;
+        }
+
+        handleCommand(ch);
+    }
+}
+
+void Simulator::handleCommand(uchar cmd)
+{
+    if (config.verbose)
+        qDebug() << "Command" << Qt::hex << cmd;
+
+    switch (cmd) {
+    case GetCommand:
+        handleGet();
+        break;
+    case GetVersionCommand:
+        handleGetVersion();
+        break;
+    case GetIDCommand:
+        handleGetId();
+        break;
+    case ReadMemoryCommand:
+        handleReadMemory();
+        break;
+    case GoCommand:
+        handleGo();
+        break;
+    case WriteMemoryCommand:
+        handleWriteMemory();
+        break;
+    case EraseMemoryCommand:
+        if (config.extendedErase)
+            nack();
+        else
+            handleErase();
+        break;
+    case ExtendedEraseMemoryCommand:
+        if (config.extendedErase)
+            handleExtendedErase();
+        else
+            nack();
+        break;
+    default:
+        nack();
+        break;
+    }
+}
+
+void Simulator::handleGet()
+{
+    QByteArray reply;
+    reply.append(Ack);
+    reply.append(char(0));
+    reply.append(BootloaderVersion);
+    reply.append(GetCommand);
+    reply.append(GetVersionCommand);
+    reply.append(GetIDCommand);
+    reply.append(ReadMemoryCommand);
+    reply.append(GoCommand);
+    reply.append(WriteMemoryCommand);
+    reply.append(config.extendedErase ? ExtendedEraseMemoryCommand : EraseMemoryCommand);
+    reply[1] = reply.size() - 3;
+    reply.append(Ack);
+    send(reply.constData(), reply.size());
+}
+
+void Simulator::handleGetVersion()
+{
+    const char reply[] = { Ack, BootloaderVersion, 0x00, 0x00, Ack };
+    send(reply, sizeof(reply));
+}
+
+void Simulator::handleGetId()
+{
+    const char reply[] = { Ack, 0x01, char(config.chipId >> 8), char(config.chipId), Ack };
+    send(reply, sizeof(reply));
+}
+
+void Simulator::handleReadMemory()
+{
+    quint32 addr;
+    ack();
+    if (!readAddress(addr))
+        return;
+
+    char count[2];
+    if (!readBytes(count, 2))
+        return;
+    wire(2);
+    int size = uchar(count[0]) + 1;
+    const char *data = memory(addr, size);
+    if (uchar(count[1]) != uchar(~count[0]) || !data) {
+        nack();
+        return;
+    }
+    ack();
+    send(data, size);
+}
+
+void Simulator::handleGo()
+{
+    quint32 addr;
+    ack();
+    if (!readAddress(addr))
+        return;
+    qDebug() << "Go to" << Qt::hex << addr;
+
+    const char *header = memory(addr, StubProtocol::ImageHeaderSize);
+    if (addr >= RamBaseAddress && header
+            && StubProtocol::get32(header + StubProtocol::MagicOffset) == StubProtocol::ImageMagic) {
+        runStub();
+        return;
+    }
+    synced = false;
+}
+
+void Simulator::handleWriteMemory()
+{
+    quint32 addr;
+    ack();
+    if (!readAddress(addr))
+        return;
+
+    char header;
+    if (!readBytes(&header, 1))
+        return;
+    int size = uchar(header) + 1;
+    char data[257];
+    if (!readBytes(data, size + 1))
+        return;
+    wire(size + 2);
+
+    char sum = header;
+    for (int i = 0; i < size; i++)
+        sum ^= data[i];
+    if (sum != data[size] || !program(addr, data, size)) {
+        nack();
+        return;
+    }
+
+    ack();
+}
+
+/*
+ * Flash follows NOR rules: programming can only clear bits, so a write
+ * over data that is not erased fails unless it leaves every bit as is.
+ * With --erased-only it fails over anything not erased, as on F0/F1/F3/L1.
+ */
+bool Simulator::program(quint32 addr, const char *data, int size)
+{
+    char *target = memory(addr, size);
+    if (!target)
+        return false;
+
+    bool isFlash = addr >= FlashBaseAddress && addr < FlashBaseAddress + flash.size();
+    if (!isFlash) {
+        memcpy(target, data, size);
+        return true;
+    }
+
+    for (int i = 0; i < size; i++) {
+        if (config.erasedOnly ? uchar(target[i]) != 0xff : (target[i] & data[i]) != data[i])
+            return false;
+    }
+    for (int i = 0; i < size; i++)
+        target[i] &= data[i];
+
+    ::usleep(config.writeUsecs * ((size + 255) / 256));
+    return true;
+}
+
+/*
+ * Plays the RAM loader stub after Go jumps to an image carrying the stub
+ * magic. The host has already moved to the stub rate; the pseudo-terminal
+ * reports it, so wire() keeps timing the new line rate. --nack-rate here
+ * answers frames with CRC errors. A stub left idle drops back to the ROM
+ * loader so the next session can sync.
+ */
+void Simulator::runStub()
+{
+    qDebug() << "Loader stub started";
+
+    forever {
+        QByteArray bytes(StubProtocol::HeaderSize, 0);
+        if (!readBytes(bytes.data(), 1, StubIdleMsecs))
+            break;
+        if (uchar(bytes.at(0)) != StubProtocol::Sync)
+            continue;
+        if (!readBytes(bytes.data() + 1, StubProtocol::HeaderSize - 1))
+            continue;
+        int length = StubProtocol::get16(bytes.constData() + 8);
+        if (length > StubProtocol::MaxPayload)
+            continue;
+        bytes.resize(StubProtocol::HeaderSize + length + StubProtocol::CrcSize);
+        if (!readBytes(bytes.data() + StubProtocol::HeaderSize, length + StubProtocol::CrcSize))
+            continue;
+        wire(bytes.size());
+
+        StubFrame request;
+        bool valid;
+        StubProtocol::decode(bytes.constData(), bytes.size(), request, valid);
+
+        StubFrame reply;
+        reply.type = request.type | StubFrame::ReplyFlag;
+        reply.seq = request.seq;
+        reply.address = request.address;
+        if (!valid || fault(config.nackRate)) {
+            if (config.verbose)
+                qDebug() << "Stub frame" << request.seq << "rejected with CRC error";
+            reply.status = StubFrame::CrcError;
+            sendStub(reply);
+            continue;
+        }
+
+        if (config.verbose)
+            qDebug() << "Stub frame" << Qt::hex << request.type << "seq" << request.seq << "at" << request.address;
+
+        switch (request.type) {
+        case StubFrame::Ping:
+            reply.payload.resize(4);
+            StubProtocol::put16(reply.payload.data(), quint16(config.stubWindow));
+            StubProtocol::put16(reply.payload.data() + 2, quint16(config.stubBlockSize));
+            break;
+        case StubFrame::Write:
+        case StubFrame::WriteLz4:
+            reply.status = quint8(stubWrite(request));
+            break;
+        case StubFrame::Checksum: {
+            const char *data = memory(request.address, request.size);
+            if (!data) {
+                reply.status = StubFrame::BadRequest;
+                break;
+            }
+            reply.payload.resize(4);
+            StubProtocol::put32(reply.payload.data(), FirmwareImage::crc32(data, request.size));
+            break;
+        }
+        case StubFrame::Exit:
+            sendStub(reply);
+            if (request.address)
+                qDebug() << "Loader stub starts application at" << Qt::hex << request.address;
+            else
+                qDebug() << "Loader stub resets";
+            synced = false;
+            return;
+        default:
+            reply.status = StubFrame::BadRequest;
+            break;
+        }
+
+        sendStub(reply);
+    }
+
+    qDebug() << "Loader stub idle, back to ROM bootloader";
+    synced = false;
+}
+
+int Simulator::stubWrite(const StubFrame &request)
+{
+    if (request.size > config.stubBlockSize)
+        return StubFrame::BadRequest;
+
+    QByteArray data;
+    if (request.type == StubFrame::WriteLz4) {
+        data.resize(request.size);
+        if (!Lz4Block::decompress(request.payload.constData(), request.payload.size(), data.data(), data.size()))
+            return StubFrame::BadRequest;
+    } else {
+        if (request.payload.size() != request.size)
+            return StubFrame::BadRequest;
+        data = request.payload;
+    }
+
+    return program(request.address, data.constData(), data.size()) ? StubFrame::Ok : StubFrame::FlashError;
+}
+
+void Simulator::sendStub(const StubFrame &reply)
+{
+    const QByteArray &bytes = StubProtocol::encode(reply);
+    send(bytes.constData(), bytes.size());
+}
+
+void Simulator::handleErase()
+{
+    ack();
+
+    char header;
+    if (!readBytes(&header, 1))
+        return;
+
+    if (uchar(header) == 0xff) {
+        char sum;
+        if (!readBytes(&sum, 1))
+            return;
+        wire(2);
+        if (sum != 0x00) {
+            nack();
+            return;
+        }
+        eraseAll();
+        ack();
+        return;
+    }
+
+    int count = uchar(header) + 1;
+    char pages[257];
+    if (!readBytes(pages, count + 1))
+        return;
+    wire(count + 2);
+
+    char sum = header;
+    for (int i = 0; i < count; i++)
+        sum ^= pages[i];
+    if (sum != pages[count]) {
+        nack();
+        return;
+    }
+
+    for (int i = 0; i < count; i++)
+        erasePage(uchar(pages[i]));
+    ack();
+}
+
+void Simulator::handleExtendedErase()
+{
+    ack();
+
+    char header[2];
+    if (!readBytes(header, 2))
+        return;
+    quint16 code = uchar(header[0]) << 8 | uchar(header[1]);
+
+    if (code >= 0xfff0) {
+        char sum;
+        if (!readBytes(&sum, 1))
+            return;
+        wire(3);
+        // single bank, so the bank erase codes are refused as on real parts
+        if (sum != (header[0] ^ header[1]) || code != 0xffff) {
+            nack();
+            return;
+        }
+        eraseAll();
+        ack();
+        return;
+    }
+
+    int count = code + 1;
+    QByteArray pages(count * 2 + 1, 0);
+    if (!readBytes(pages.data(), pages.size()))
+        return;
+    wire(pages.size() + 2);
+
+    char sum = header[0] ^ header[1];
+    for (int i = 0; i < count * 2; i++)
+        sum ^= pages.at(i);
+    if (sum != pages.at(count * 2)) {
+        nack();
+        return;
+    }
+
+    for (int i = 0; i < count; i++)
+        erasePage(uchar(pages.at(i * 2)) << 8 | uchar(pages.at(i * 2 + 1)));
+    ack();
+}
+
+void Simulator::erasePage(int page)
+{
+    if (page >= config.sectors.size())
+        return;
+    const ChipInfo::Sector &sector = config.sectors.at(page);
+    memset(flash.data() + sector.address, 0xff, sector.size);
+    ::usleep(config.pageEraseMsecs * 1000);
+}
+
+void Simulator::eraseAll()
+{
+    flash.fill(0xff);
+    ::usleep(config.pageEraseMsecs * 1000 * config.sectors.size());
+}
+
+bool Simulator::readBytes(char *data, int size, int msec)
+{
+    int received = 0;
+
+    while (received < size) {
+        struct pollfd pfd;
+        pfd.fd = master;
+        pfd.events = POLLIN;
+        int ret = poll(&pfd, 1, msec);
+        if (ret <= 0)
+            return false;
+        if (!(pfd.revents & POLLIN)) {
+            if (msec >= 0)
+                return false;
+            ::usleep(10000);
+            continue;
+        }
+        ssize_t bytes = ::read(master, data + received, size - received);
+        if (bytes <= 0)
+            return false;
+        received += bytes;
+    }
+
+    return true;
+}
+
+bool Simulator::readAddress(quint32 &addr)
+{
+    char frame[5];
+    if (!readBytes(frame, sizeof(frame)))
+        return false;
+    wire(sizeof(frame));
+
+    if ((frame[0] ^ frame[1] ^ frame[2] ^ frame[3]) != frame[4]) {
+        nack();
+        return false;
+    }
+
+    addr = uchar(frame[0]) << 24 | uchar(frame[1]) << 16 | uchar(frame[2]) << 8 | uchar(frame[3]);
+    if (!memory(addr, 1)) {
+        nack();
+        return false;
+    }
+
+    ack();
+    return true;
+}
+
+void Simulator::send(const char *data, int size)
+{
+    wire(size);
+
+    for (int i = 0; i < size; i++) {
+        if (fault(config.dropRate)) {
+            if (config.verbose)
+                qDebug() << "Inject drop of byte" << i << "of" << size;
+            continue;
+        }
+        if (::write(master, data + i, 1) != 1)
+            return;
+    }
+}
+
+void Simulator::sendByte(char ch)
+{
+    send(&ch, 1);
+}
+
+void Simulator::ack()
+{
+    sendByte(Ack);
+}
+
+void Simulator::nack()
+{
+    sendByte(Nack);
+}
+
+bool Simulator::fault(double rate) const
+{
+    return rate > 0 && rand() < rate * RAND_MAX;
+}
+
+void Simulator::wire(int bytes)
+{
+    int baudrate = config.baudrate > 0 ? config.baudrate : hostBaudrate();
+    if (baudrate > 0)
+        ::usleep(qint64(bytes) * BitsPerByte * 1000000 / baudrate);
+}
+
+int Simulator::hostBaudrate() const
+{
+    static const struct {
+        speed_t speed;
+        int baudrate;
+    } speeds[] = {
+        { B1200, 1200 }, { B2400, 2400 }, { B4800, 4800 }, { B9600, 9600 },
+        { B19200, 19200 }, { B38400, 38400 }, { B57600, 57600 },
+        { B115200, 115200 }, { B230400, 230400 }, { B460800, 460800 },
+        { B921600, 921600 }, { B1000000, 1000000 }, { B2000000, 2000000 },
+        { B3000000, 3000000 }, { B4000000, 4000000 }
+    };
+
+    struct termios tio;
+    if (tcgetattr(master, &tio) < 0)
+        return 0;
+
+    speed_t speed = cfgetospeed(&tio);
+    for (size_t i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+        if (speeds[i].speed == speed)
+            return speeds[i].baudrate;
+    }
+
+    return 0;
+}
+
+char *Simulator::memory(quint32 addr, int size)
+{
+    if (addr >= FlashBaseAddress && addr + size <= FlashBaseAddress + flash.size())
+        return flash.data() + (addr - FlashBaseAddress);
+    if (addr >= RamBaseAddress && addr + size <= RamBaseAddress + ram.size())
+        return ram.data() + (addr - RamBaseAddress);
+    if (addr >= config.uniqueIdAddress && addr + size <= config.uniqueIdAddress + uniqueId.size())
+        return uniqueId.data() + (addr - config.uniqueIdAddress);
+    if (config.flashSizeRegister && addr >= config.flashSizeRegister
+            && addr + size <= config.flashSizeRegister + flashSizeKb.size())
+        return flashSizeKb.data() + (addr - config.flashSizeRegister);
+    return 0;
+}
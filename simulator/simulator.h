@@ -0,0 +1,122 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <QByteArray>
+#include <QString>
+
+#include "stubprotocol.h"
+#include "chipdatabase.h"
+
+struct SimulatorConfig
+{
+    SimulatorConfig() :
+        chipId(0x414),
+        flashSize(512 * 1024),
+        ramSize(64 * 1024),
+        uniqueIdAddress(0x1ffff7e8),
+        flashSizeRegister(0),
+        extendedErase(true),
+        erasedOnly(false),
+        pageEraseMsecs(20),
+        writeUsecs(100),
+        baudrate(0),
+        maxBaudrate(0),
+        nackRate(0),
+        dropRate(0),
+        timeoutRate(0),
+        stubWindow(8),
+        stubBlockSize(4096),
+        verbose(false)
+    {
+    }
+
+    int chipId;
+    int flashSize;
+    QList<ChipInfo::Sector> sectors;
+    int ramSize;
+    quint32 uniqueIdAddress;
+    quint32 flashSizeRegister;
+    bool extendedErase;
+    bool erasedOnly;
+    int pageEraseMsecs;
+    int writeUsecs;
+    int baudrate;
+    int maxBaudrate;
+    double nackRate;
+    double dropRate;
+    double timeoutRate;
+    int stubWindow;
+    int stubBlockSize;
+    bool verbose;
+};
+
+class Simulator
+{
+public:
+    explicit Simulator(const SimulatorConfig &config);
+    ~Simulator();
+
+    bool open();
+    QString slaveName() const;
+    int exec();
+
+private:
+    void handleCommand(uchar cmd);
+    void handleGet();
+    void handleGetVersion();
+    void handleGetId();
+    void handleReadMemory();
+    void handleGo();
+    void handleWriteMemory();
+    void handleErase();
+    void handleExtendedErase();
+    void erasePage(int page);
+    void eraseAll();
+    bool program(quint32 addr, const char *data, int size);
+    void runStub();
+    int stubWrite(const StubFrame &request);
+    void sendStub(const StubFrame &reply);
+
+    bool readBytes(char *data, int size, int msec = 1000);
+    bool readAddress(quint32 &addr);
+    void send(const char *data, int size);
+    void sendByte(char ch);
+    void ack();
+    void nack();
+    bool fault(double rate) const;
+    void wire(int bytes);
+    int hostBaudrate() const;
+    char *memory(quint32 addr, int size);
+
+private:
+    SimulatorConfig config;
+    int master;
+    bool synced;
+    QByteArray flash;
+    QByteArray ram;
+    QByteArray uniqueId;
+    QByteArray flashSizeKb;
+};
+
+#endif // SIMULATOR_H
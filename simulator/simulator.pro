@@ -0,0 +1,30 @@
+#-------------------------------------------------
+#
+# STM32 bootloader simulator on a pseudo-terminal
+#
+#-------------------------------------------------
+
+QT       += core
+QT       -= gui
+
+TARGET = stm32sim
+TEMPLATE = app
+CONFIG   += console
+CONFIG   -= app_bundle
+
+INCLUDEPATH += ..
+DEPENDPATH += ..
+
+SOURCES += main.cpp \
+    simulator.cpp \
+    ../stubprotocol.cpp \
+    ../lz4block.cpp \
+    ../firmwareimage.cpp \
+    ../chipdatabase.cpp
+
+HEADERS += simulator.h \
+    ../stubprotocol.h \
+    ../lz4block.h \
+    ../firmwareimage.h \
+    ../chipdatabase.h \
+    ../qtcompat.h
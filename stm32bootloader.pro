@@ -14,13 +14,21 @@ TEMPLATE = app
 
 SOURCES += main.cpp\
         mainwindow.cpp \
-    bootloader.cpp \
     settings.cpp \
-    consolescreen.cpp
+    consolescreen.cpp \
+    gangdialog.cpp \
+    ringbuffer.cpp \
+    capturewriter.cpp \
+    lineindex.cpp
 
 HEADERS  += mainwindow.h \
-    bootloader.h \
     settings.h \
-    consolescreen.h
+    consolescreen.h \
+    gangdialog.h \
+    ringbuffer.h \
+    capturewriter.h \
+    lineindex.h
 
 FORMS    += mainwindow.ui
+
+include(bootloader.pri)
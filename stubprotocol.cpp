@@ -0,0 +1,90 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <cstring>
+
+#include "firmwareimage.h"
+#include "stubprotocol.h"
+
+void StubProtocol::put32(char *data, quint32 value)
+{
+    data[0] = char(value);
+    data[1] = char(value >> 8);
+    data[2] = char(value >> 16);
+    data[3] = char(value >> 24);
+}
+
+void StubProtocol::put16(char *data, quint16 value)
+{
+    data[0] = char(value);
+    data[1] = char(value >> 8);
+}
+
+QByteArray StubProtocol::encode(const StubFrame &frame)
+{
+    int length = frame.payload.size();
+    QByteArray bytes(HeaderSize + length + CrcSize, 0);
+    char *p = bytes.data();
+
+    p[0] = char(Sync);
+    p[1] = char(frame.type);
+    p[2] = char(frame.seq);
+    p[3] = char(frame.status);
+    put32(p + 4, frame.address);
+    put16(p + 8, quint16(length));
+    put16(p + 10, frame.size);
+    memcpy(p + HeaderSize, frame.payload.constData(), length);
+    put32(p + HeaderSize + length, FirmwareImage::crc32(p + 1, HeaderSize - 1 + length));
+    return bytes;
+}
+
+/*
+ * Returns the bytes consumed, or 0 when more are needed. Bytes before a
+ * sync are skipped one at a time. A frame whose CRC fails is consumed whole
+ * with valid cleared, its header still filled in so the receiver can name
+ * the sequence it rejects.
+ */
+int StubProtocol::decode(const char *data, int size, StubFrame &frame, bool &valid)
+{
+    valid = false;
+    if (size < 1)
+        return 0;
+    if (uchar(data[0]) != Sync)
+        return 1;
+    if (size < HeaderSize)
+        return 0;
+
+    int length = get16(data + 8);
+    if (length > MaxPayload)
+        return 1;
+    int total = HeaderSize + length + CrcSize;
+    if (size < total)
+        return 0;
+
+    frame.type = quint8(data[1]);
+    frame.seq = quint8(data[2]);
+    frame.status = quint8(data[3]);
+    frame.address = get32(data + 4);
+    frame.size = get16(data + 10);
+    frame.payload = QByteArray(data + HeaderSize, length);
+    valid = FirmwareImage::crc32(data + 1, HeaderSize - 1 + length) == get32(data + HeaderSize + length);
+    return total;
+}
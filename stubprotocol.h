@@ -0,0 +1,115 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef STUBPROTOCOL_H
+#define STUBPROTOCOL_H
+
+#include <QByteArray>
+
+/*
+ * Streaming protocol spoken by the RAM-resident second-stage loader once the
+ * ROM bootloader has jumped to it with Go.
+ *
+ * The stub image starts with a Cortex-M vector table (initial SP, reset
+ * handler); word 2 holds ImageMagic, word 3 the protocol version and word 4
+ * is patched by the host with the baudrate the stub switches to.
+ *
+ * Every frame, in both directions, is little endian:
+ *
+ *   sync 0xa5, type, seq, status, address(4), length(2), size(2),
+ *   payload[length], crc32(4) over everything after sync
+ *
+ * size is the decoded byte count of a write and the range of a checksum
+ * request. Exit starts the vector table at address, or resets when it is
+ * 0. Replies carry the request type with ReplyFlag set and echo seq.
+ */
+struct StubFrame
+{
+    enum Type {
+        Ping = 0x01,
+        Write = 0x02,
+        WriteLz4 = 0x03,
+        Checksum = 0x04,
+        Exit = 0x05,
+        ReplyFlag = 0x80
+    };
+
+    enum Status {
+        Ok = 0,
+        CrcError = 1,
+        FlashError = 2,
+        BadRequest = 3
+    };
+
+    StubFrame() :
+        type(0),
+        seq(0),
+        status(Ok),
+        address(0),
+        size(0)
+    {
+    }
+
+    quint8 type;
+    quint8 seq;
+    quint8 status;
+    quint32 address;
+    quint16 size;
+    QByteArray payload;
+};
+
+class StubProtocol
+{
+public:
+    enum {
+        Sync = 0xa5,
+        HeaderSize = 12,
+        CrcSize = 4,
+        MaxPayload = 8192,
+        ImageHeaderSize = 20,
+        MagicOffset = 8,
+        VersionOffset = 12,
+        BaudrateOffset = 16
+    };
+
+    static const quint32 ImageMagic = 0x42555453;
+    static const quint32 Version = 1;
+
+    static QByteArray encode(const StubFrame &frame);
+    static int decode(const char *data, int size, StubFrame &frame, bool &valid);
+
+    static quint32 get32(const char *data)
+    {
+        const uchar *p = reinterpret_cast<const uchar *>(data);
+        return p[0] | p[1] << 8 | p[2] << 16 | quint32(p[3]) << 24;
+    }
+
+    static quint16 get16(const char *data)
+    {
+        const uchar *p = reinterpret_cast<const uchar *>(data);
+        return quint16(p[0] | p[1] << 8);
+    }
+
+    static void put32(char *data, quint32 value);
+    static void put16(char *data, quint16 value);
+};
+
+#endif // STUBPROTOCOL_H
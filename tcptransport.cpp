@@ -0,0 +1,118 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include "tcptransport.h"
+
+TcpTransport::TcpTransport(const QString &hostPort) :
+    hostPort(hostPort),
+    baudrate(0)
+{
+
+}
+
+bool TcpTransport::open(qint32 baudrate)
+{
+    int colon = hostPort.lastIndexOf(':');
+    bool ok = false;
+    quint16 port = colon > 0 ? hostPort.mid(colon + 1).toUShort(&ok) : 0;
+    if (!ok) {
+        error = QString("%1 is not host:port").arg(hostPort);
+        return false;
+    }
+
+    socket.connectToHost(hostPort.left(colon), port);
+    if (!socket.waitForConnected(ConnectMsecs)) {
+        error = socket.errorString();
+        return false;
+    }
+
+    socket.setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    this->baudrate = baudrate;
+    error.clear();
+    return true;
+}
+
+void TcpTransport::close()
+{
+    socket.abort();
+}
+
+bool TcpTransport::setBaudRate(qint32 baudrate)
+{
+    this->baudrate = baudrate;
+    return true;
+}
+
+qint32 TcpTransport::baudRate() const
+{
+    return baudrate;
+}
+
+void TcpTransport::setDataTerminalReady(bool set)
+{
+    Q_UNUSED(set);
+}
+
+void TcpTransport::setRequestToSend(bool set)
+{
+    Q_UNUSED(set);
+}
+
+/*
+ * With Nagle off, flush() sends the frame in one call without waiting for
+ * the event loop.
+ */
+qint64 TcpTransport::write(const char *data, qint64 size)
+{
+    qint64 written = socket.write(data, size);
+    socket.flush();
+    return written;
+}
+
+qint64 TcpTransport::read(char *data, qint64 maxSize)
+{
+    return socket.read(data, maxSize);
+}
+
+qint64 TcpTransport::bytesAvailable()
+{
+    return socket.bytesAvailable();
+}
+
+bool TcpTransport::waitForReadyRead(int msecs)
+{
+    return socket.waitForReadyRead(msecs);
+}
+
+bool TcpTransport::waitForBytesWritten(int msecs)
+{
+    return !socket.bytesToWrite() || socket.waitForBytesWritten(msecs);
+}
+
+void TcpTransport::discardInput()
+{
+    socket.readAll();
+}
+
+QString TcpTransport::errorString() const
+{
+    return error.isEmpty() ? socket.errorString() : error;
+}
@@ -0,0 +1,43 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include "serialtransport.h"
+#include "ptytransport.h"
+#include "tcptransport.h"
+#include "transport.h"
+
+/*
+ * "tcp://host:port" connects to a serial server, "pty:/dev/pts/N" or a
+ * path under /dev/pts/ drives a pseudo-terminal directly, anything else
+ * is a serial port name.
+ */
+Transport *Transport::create(const QString &name)
+{
+    if (name.startsWith("tcp://"))
+        return new TcpTransport(name.mid(6));
+#ifdef Q_OS_UNIX
+    if (name.startsWith("pty:"))
+        return new PtyTransport(name.mid(4));
+    if (name.startsWith("/dev/pts/"))
+        return new PtyTransport(name);
+#endif
+    return new SerialTransport(name);
+}
@@ -0,0 +1,55 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <QString>
+
+/*
+ * Byte link to the bootloader, driven blocking from the session thread.
+ * write() hands the whole buffer to the OS at once, so each frame leaves
+ * in a single system call. The modem lines steer BOOT0 (DTR) and reset
+ * (RTS) where the link has them and are ignored elsewhere.
+ */
+class Transport
+{
+public:
+    virtual ~Transport() {}
+
+    static Transport *create(const QString &name);
+
+    virtual bool open(qint32 baudrate) = 0;
+    virtual void close() = 0;
+    virtual bool setBaudRate(qint32 baudrate) = 0;
+    virtual qint32 baudRate() const = 0;
+    virtual void setDataTerminalReady(bool set) = 0;
+    virtual void setRequestToSend(bool set) = 0;
+    virtual qint64 write(const char *data, qint64 size) = 0;
+    virtual qint64 read(char *data, qint64 maxSize) = 0;
+    virtual qint64 bytesAvailable() = 0;
+    virtual bool waitForReadyRead(int msecs) = 0;
+    virtual bool waitForBytesWritten(int msecs) = 0;
+    virtual void discardInput() = 0;
+    virtual QString errorString() const = 0;
+};
+
+#endif // TRANSPORT_H
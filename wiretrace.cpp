@@ -0,0 +1,141 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <cstring>
+#include <QDataStream>
+#include <QFile>
+
+#include "wiretrace.h"
+
+static const char Magic[4] = { 'S', 'T', 'W', 'T' };
+static const quint32 Version = 1;
+
+WireTrace::WireTrace(int slots) :
+    ring(slots),
+    head(0),
+    total(0)
+{
+
+}
+
+void WireTrace::start()
+{
+    head = 0;
+    total = 0;
+    timer.start();
+}
+
+void WireTrace::record(Direction direction, const char *data, int size)
+{
+    qint64 nsecs = timer.nsecsElapsed();
+
+    do {
+        Record &slot = ring[head];
+        int length = qMin(size, int(SlotDataSize));
+        slot.nsecs = nsecs;
+        slot.direction = quint8(direction);
+        slot.size = quint8(length);
+        memcpy(slot.data, data, length);
+        data += length;
+        size -= length;
+        if (++head == ring.size())
+            head = 0;
+        total++;
+    } while (size > 0);
+}
+
+/*
+ * Header: "STWT", version, record count and the number of records lost to
+ * wrap-around. Each record is its timestamp, direction, size and payload,
+ * little endian, oldest first.
+ */
+bool WireTrace::save(const QString &filename, QString *error) const
+{
+    QByteArray bytes;
+    QDataStream stream(&bytes, QIODevice::WriteOnly);
+    stream.setByteOrder(QDataStream::LittleEndian);
+
+    int n = count();
+    stream.writeRawData(Magic, sizeof(Magic));
+    stream << Version << quint32(n) << quint64(dropped());
+
+    int index = total > ring.size() ? head : 0;
+    for (int i = 0; i < n; i++) {
+        const Record &slot = ring.at(index);
+        stream << slot.nsecs << slot.direction << slot.size;
+        stream.writeRawData(slot.data, slot.size);
+        if (++index == ring.size())
+            index = 0;
+    }
+
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly) || file.write(bytes) != bytes.size()) {
+        if (error)
+            *error = file.errorString();
+        return false;
+    }
+
+    return true;
+}
+
+bool WireTrace::load(const QString &filename, QVector<Record> &records, QString *error)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (error)
+            *error = file.errorString();
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setByteOrder(QDataStream::LittleEndian);
+
+    char magic[sizeof(Magic)];
+    quint32 version, n;
+    quint64 dropped;
+    if (stream.readRawData(magic, sizeof(magic)) != int(sizeof(magic))
+            || memcmp(magic, Magic, sizeof(Magic)) != 0) {
+        if (error)
+            *error = "Not a wire trace";
+        return false;
+    }
+    stream >> version >> n >> dropped;
+    if (version != Version) {
+        if (error)
+            *error = QString("Unsupported trace version %1").arg(version);
+        return false;
+    }
+
+    records.resize(0);
+    records.reserve(int(n));
+    for (quint32 i = 0; i < n; i++) {
+        Record slot;
+        stream >> slot.nsecs >> slot.direction >> slot.size;
+        if (slot.size > SlotDataSize || stream.readRawData(slot.data, slot.size) != slot.size) {
+            if (error)
+                *error = "Truncated trace";
+            return false;
+        }
+        records.append(slot);
+    }
+
+    return true;
+}
@@ -0,0 +1,87 @@
+/*
+ * STM32 Bootloader
+ *
+ * Copyright (c) 2015, longfeng.xiao <xlongfeng@126.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef WIRETRACE_H
+#define WIRETRACE_H
+
+#include <QElapsedTimer>
+#include <QString>
+#include <QVector>
+
+/*
+ * Ring of fixed-size slots recording every byte run on the wire. Runs longer
+ * than a slot are split over consecutive slots with the same timestamp; once
+ * the ring is full the oldest slots are overwritten, so a failed session
+ * keeps the exchange that led up to the failure.
+ */
+class WireTrace
+{
+public:
+    enum Direction {
+        Tx,
+        Rx,
+        Marker
+    };
+
+    enum {
+        SlotDataSize = 52,
+        DefaultSlots = 16384
+    };
+
+    struct Record
+    {
+        qint64 nsecs;
+        quint8 direction;
+        quint8 size;
+        char data[SlotDataSize];
+    };
+
+    explicit WireTrace(int slots = DefaultSlots);
+
+    void start();
+    void record(Direction direction, const char *data, int size);
+
+    void mark(const char *text)
+    {
+        record(Marker, text, int(qstrlen(text)));
+    }
+
+    int count() const
+    {
+        return int(qMin(total, qint64(ring.size())));
+    }
+
+    qint64 dropped() const
+    {
+        return total - count();
+    }
+
+    bool save(const QString &filename, QString *error = 0) const;
+    static bool load(const QString &filename, QVector<Record> &records, QString *error = 0);
+
+private:
+    QVector<Record> ring;
+    int head;
+    qint64 total;
+    QElapsedTimer timer;
+};
+
+#endif // WIRETRACE_H